@@ -451,8 +451,8 @@ int tgp_visualize_key (struct tgl_state *TLS, unsigned char* sha1_key) {
     0x2f99c9
   };
   unsigned img_size = 160;
-  unsigned char* image = (unsigned char*)malloc (img_size * img_size * 4);
-  assert (image);
+  unsigned char *image;
+  unsigned char *tga = p2tgl_tga_new (img_size, img_size, &image);
   unsigned x, y, i, j, idx = 0;
   int bitpointer = 0;
   for (y = 0; y < 8; y++)
@@ -480,9 +480,8 @@ int tgp_visualize_key (struct tgl_state *TLS, unsigned char* sha1_key) {
       }
     }
   }
-  int imgStoreId = p2tgl_imgstore_add_with_id_raw(image, img_size, img_size);
+  int imgStoreId = p2tgl_imgstore_add_with_id_tga (tga, img_size, img_size);
   used_images_add ((connection_data*)TLS->ev_base, imgStoreId);
-  g_free (image);
   return imgStoreId;
 }
 
@@ -196,7 +196,7 @@ static void update_user_status_handler (struct tgl_state *TLS, struct tgl_user *
 
 static void update_message_handler (struct tgl_state *TLS, struct tgl_message *M) {
   write_files_schedule (TLS);
-  tgp_msg_recv (TLS, M, NULL);
+  tgp_msg_recv (TLS, M, FALSE);
 }
 
 static void update_secret_chat_typing (struct tgl_state *TLS, struct tgl_secret_chat *E) {
@@ -237,23 +237,7 @@ static void on_get_dialog_list_done (struct tgl_state *TLS, void *extra, int suc
   }
   
   // add all peers in the dialogue list to the buddy list
-  int i;
-  for (i = size - 1; i >= 0; i--) {
-    tgl_peer_t *UC = tgl_peer_get (TLS, peers[i]);
-    if (! UC) {
-      g_warn_if_reached ();
-      continue;
-    }
-    // our own contact shouldn't show up in our buddy list
-    if (tgl_get_peer_id (UC->id) == tgl_get_peer_id (TLS->our_id)) {
-      continue;
-    }
-    if (tgl_get_peer_type (UC->id) == TGL_PEER_USER) {
-      if (! (UC->user.flags & TGLUF_DELETED)) {
-        tgp_blist_contact_add (TLS, &UC->user);
-      }
-    }
-  }
+  tgp_blist_contacts_add (TLS, peers, size);
   
   // handle pending roomlist request
   if (conn->roomlist != NULL && purple_roomlist_get_in_progress (conn->roomlist)) {
@@ -270,7 +254,7 @@ static void on_get_channel_list_done (struct tgl_state *TLS, void *callback_extr
   int i;
   for (i = 0; i < size; i ++) {
     if (! tgp_channel_loaded (TLS, peers[i])) {
-      tgp_channel_load (TLS, tgl_peer_get (TLS, peers[i]), NULL, NULL);
+      tgp_channel_load_queue (TLS, peers[i], unread_count ? unread_count[i] : 0);
     }
   }
 }
@@ -492,6 +476,11 @@ static void update_on_logged_in (struct tgl_state *TLS) {
   
   purple_blist_add_account (tls_get_pa (TLS));
   tgp_blist_lookup_init (TLS);
+
+  if (! tls_get_data (TLS)->status_timer) {
+    tls_get_data (TLS)->status_timer = purple_timeout_add_seconds (TGP_STATUS_SWEEP_INTERVAL,
+        p2tgl_prpl_user_status_sweep, tls_get_data (TLS));
+  }
   
   // It is important to load secret chats exactly at this point during login, cause if it was done earlier,
   // the update function wouldn't find existing chats and create duplicate entries. If it was done later, eventual
@@ -511,6 +500,7 @@ static void update_on_ready (struct tgl_state *TLS) {
   tgl_do_get_dialog_list (TLS, 200, 0, on_get_dialog_list_done, NULL);
   tgl_do_get_channels_dialog_list (TLS, 50, 0, on_get_channel_list_done, NULL);
   tgl_do_update_contact_list (TLS, 0, 0);
+  tgprpl_xfer_offer_interrupted (TLS);
 }
 
 static void update_on_failed_login (struct tgl_state *TLS) {
@@ -526,6 +516,90 @@ static void update_on_failed_login (struct tgl_state *TLS) {
 }
 
 static gulong chat_conversation_typing_signal = 0;
+static gulong deleting_conversation_signal = 0;
+static gulong conversation_created_signal = 0;
+
+// Chat conversations are opened by tgp_chat_show(), which promotes their queued content itself, since
+// their id is only set after this signal was emitted.
+static void tgprpl_conversation_created (PurpleConversation *conv, gpointer ignored) {
+  PurpleConnection *gc = purple_conversation_get_gc (conv);
+  if (! gc || ! PURPLE_CONNECTION_IS_CONNECTED (gc) || purple_conversation_get_type (conv) != PURPLE_CONV_TYPE_IM) {
+    return;
+  }
+  if (g_strcmp0 (purple_plugin_get_id (purple_connection_get_prpl (gc)), PLUGIN_ID)) {
+    return;
+  }
+
+  tgl_peer_t *P = tgp_blist_lookup_peer_get (gc_get_tls (gc), purple_conversation_get_name (conv));
+  if (P) {
+    tgp_msg_media_conv_opened (gc_get_tls (gc), P->id);
+  }
+}
+
+static void tgprpl_conversation_deleted (PurpleConversation *conv, gpointer ignored) {
+  PurpleConnection *gc = purple_conversation_get_gc (conv);
+  if (! gc || ! PURPLE_CONNECTION_IS_CONNECTED (gc)) {
+    return;
+  }
+  if (g_strcmp0 (purple_plugin_get_id (purple_connection_get_prpl (gc)), PLUGIN_ID)) {
+    return;
+  }
+
+  tgl_peer_t *P = NULL;
+  if (purple_conversation_get_type (conv) == PURPLE_CONV_TYPE_CHAT) {
+    int id = purple_conv_chat_get_id (PURPLE_CONV_CHAT (conv));
+    P = tgl_peer_get (gc_get_tls (gc), TGL_MK_CHAT (id));
+    if (! P) {
+      P = tgl_peer_get (gc_get_tls (gc), TGL_MK_CHANNEL (id));
+    }
+  } else {
+    P = tgp_blist_lookup_peer_get (gc_get_tls (gc), purple_conversation_get_name (conv));
+  }
+
+  // the user left the conversation, content that isn't loading yet is not needed anymore
+  if (P) {
+    tgp_msg_media_cancel (gc_get_tls (gc), P->id);
+  }
+}
+
+static gulong blist_node_added_signal = 0;
+static gulong blist_node_removed_signal = 0;
+
+static struct tgl_state *tgprpl_blist_node_get_tls (PurpleBlistNode *node) {
+  PurpleAccount *pa = NULL;
+  if (PURPLE_BLIST_NODE_IS_BUDDY (node)) {
+    pa = purple_buddy_get_account ((PurpleBuddy *) node);
+  } else if (PURPLE_BLIST_NODE_IS_CHAT (node)) {
+    pa = purple_chat_get_account ((PurpleChat *) node);
+  }
+  if (! pa || g_strcmp0 (purple_account_get_protocol_id (pa), PLUGIN_ID)) {
+    return NULL;
+  }
+  PurpleConnection *gc = purple_account_get_connection (pa);
+  if (! gc || ! gc_get_data (gc)) {
+    return NULL;
+  }
+  return gc_get_tls (gc);
+}
+
+static void tgprpl_blist_node_added (PurpleBlistNode *node, gpointer ignored) {
+  struct tgl_state *TLS = tgprpl_blist_node_get_tls (node);
+  if (TLS) {
+    tgp_blist_index_add (TLS, node);
+
+    // new buddies start out offline, the next status update must not be skipped
+    if (PURPLE_BLIST_NODE_IS_BUDDY (node) && tgp_blist_buddy_has_id ((PurpleBuddy *) node)) {
+      p2tgl_prpl_user_status_reset (TLS, tgp_blist_buddy_get_id ((PurpleBuddy *) node));
+    }
+  }
+}
+
+static void tgprpl_blist_node_removed (PurpleBlistNode *node, gpointer ignored) {
+  struct tgl_state *TLS = tgprpl_blist_node_get_tls (node);
+  if (TLS) {
+    tgp_blist_index_remove (TLS, node);
+  }
+}
 
 static void tgprpl_login (PurpleAccount * acct) {
   info ("tgprpl_login(): Purple is telling the prpl to connect the account");
@@ -554,6 +628,17 @@ static void tgprpl_login (PurpleAccount * acct) {
 #endif
   debug ("telegram download uri base: '%s'", conn->download_uri);
 
+  // BitlBee links to all pictures in the download directory, so they cannot be moved into the cache
+  int cache_size = purple_account_get_int (acct, TGP_KEY_MEDIA_CACHE_SIZE, TGP_DEFAULT_MEDIA_CACHE_SIZE);
+  if (cache_size > 0 && g_strcmp0 (purple_core_get_ui(), "BitlBee")) {
+    gchar *root = g_path_get_dirname (TLS->base_path);
+    gchar *cache_dir = g_build_filename (root, "media-cache", NULL);
+    tgp_cache_init (cache_dir, (gint64) cache_size << 20);
+    conn->media_cache = TRUE;
+    g_free (cache_dir);
+    g_free (root);
+  }
+
   tgl_set_rsa_key_direct (TLS, tglmp_get_default_e(),
                                tglmp_get_default_key_len(),
                                tglmp_get_default_key());
@@ -608,10 +693,27 @@ static void tgprpl_login (PurpleAccount * acct) {
     chat_conversation_typing_signal = purple_signal_connect(purple_conversations_get_handle(), "chat-conversation-typing", 
       purple_connection_get_prpl (gc), PURPLE_CALLBACK(tgprpl_send_chat_typing), NULL);
   }
+  if (!deleting_conversation_signal) {
+    deleting_conversation_signal = purple_signal_connect (purple_conversations_get_handle(), "deleting-conversation",
+      purple_connection_get_prpl (gc), PURPLE_CALLBACK(tgprpl_conversation_deleted), NULL);
+  }
+  if (!conversation_created_signal) {
+    conversation_created_signal = purple_signal_connect (purple_conversations_get_handle(), "conversation-created",
+      purple_connection_get_prpl (gc), PURPLE_CALLBACK(tgprpl_conversation_created), NULL);
+  }
+  if (!blist_node_added_signal) {
+    blist_node_added_signal = purple_signal_connect (purple_blist_get_handle (), "blist-node-added",
+      purple_connection_get_prpl (gc), PURPLE_CALLBACK(tgprpl_blist_node_added), NULL);
+  }
+  if (!blist_node_removed_signal) {
+    blist_node_removed_signal = purple_signal_connect (purple_blist_get_handle (), "blist-node-removed",
+      purple_connection_get_prpl (gc), PURPLE_CALLBACK(tgprpl_blist_node_removed), NULL);
+  }
 }
 
 static void tgprpl_close (PurpleConnection *gc) {
   debug ("tgprpl_close()");
+  tgp_blist_lookup_report (gc_get_tls (gc));
   connection_data_free (purple_connection_get_protocol_data (gc));
 }
 
@@ -874,11 +976,39 @@ static void tgprpl_init (PurplePlugin *plugin) {
   opt = purple_account_option_list_new (_("Bigger file transfers"), TGP_KEY_FT_HANDLING, choices);
   prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
 
+  opt = purple_account_option_int_new (_("Parallel loads of pictures and media"), TGP_KEY_MEDIA_CONCURRENCY,
+                                       TGP_DEFAULT_MEDIA_CONCURRENCY);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+  opt = purple_account_option_int_new (_("Media cache shared by all accounts (MB)\n(0 to disable)"),
+      TGP_KEY_MEDIA_CACHE_SIZE, TGP_DEFAULT_MEDIA_CACHE_SIZE);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+  opt = purple_account_option_int_new (_("Parallel file transfers per direction"), TGP_KEY_XFER_CONCURRENCY,
+      TGP_DEFAULT_XFER_CONCURRENCY);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+  opt = purple_account_option_int_new (_("Offer to download interrupted files again for (days)\n(0 to disable)"),
+      TGP_KEY_XFER_REDOWNLOAD_DAYS, TGP_DEFAULT_XFER_REDOWNLOAD_DAYS);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+  opt = purple_account_option_int_new (_("File transfer progress updates per second\n(0 to disable)"),
+      TGP_KEY_XFER_PROGRESS_RATE, TGP_DEFAULT_XFER_PROGRESS_RATE);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
   // Chats
   opt = purple_account_option_bool_new (_("Add all group chats to buddy list"),
       TGP_KEY_JOIN_GROUP_CHATS, TGP_DEFAULT_JOIN_GROUP_CHATS);
   prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
 
+  opt = purple_account_option_int_new (_("Load members of supergroups up to\n(0 to disable)"),
+      TGP_KEY_CHANNEL_MEMBERS, TGP_DEFAULT_CHANNEL_MEMBERS);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+  opt = purple_account_option_int_new (_("Fetch missed channel messages up to\n(0 for unlimited)"),
+      TGP_KEY_CHANNEL_HISTORY_GAP, TGP_DEFAULT_CHANNEL_HISTORY_GAP);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
   // Receipts
   opt = purple_account_option_bool_new (_("Display notices of receipt"),
       TGP_KEY_DISPLAY_READ_NOTIFICATIONS, TGP_DEFAULT_DISPLAY_READ_NOTIFICATIONS);
@@ -888,6 +1018,17 @@ static void tgprpl_init (PurplePlugin *plugin) {
       TGP_KEY_SEND_READ_NOTIFICATIONS, TGP_DEFAULT_SEND_READ_NOTIFICATIONS);
   prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
 
+  // Bandwidth, the limits for all accounts together are set with an account action
+  opt = purple_account_option_int_new (_("Limit uploads to (kB/s)\n(0 for unlimited)"), TGP_KEY_UPLOAD_LIMIT, 0);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+  opt = purple_account_option_int_new (_("Limit downloads to (kB/s)\n(0 for unlimited)"), TGP_KEY_DOWNLOAD_LIMIT, 0);
+  prpl_info.protocol_options = g_list_append (prpl_info.protocol_options, opt);
+
+  purple_prefs_add_none (TGP_PREF_ROOT);
+  purple_prefs_add_int (TGP_PREF_UPLOAD_LIMIT, 0);
+  purple_prefs_add_int (TGP_PREF_DOWNLOAD_LIMIT, 0);
+
   // IPv6
   opt = purple_account_option_bool_new (_("Use IPv6 for connecting (restart required)"),
       TGP_KEY_USE_IPV6, TGP_DEFAULT_USE_IPV6);
@@ -897,8 +1038,41 @@ static void tgprpl_init (PurplePlugin *plugin) {
   debug ("tgprpl_init finished: This is " PACKAGE_VERSION "+g" GIT_COMMIT " on libtgl " TGL_VERSION);
 }
 
+static void tgprpl_action_show_latency (PurplePluginAction *action) {
+  PurpleConnection *gc = (PurpleConnection *) action->context;
+  g_return_if_fail (gc_get_data (gc));
+  tgp_trace_show (gc_get_tls (gc));
+}
+
+static void tgprpl_action_show_xfers (PurplePluginAction *action) {
+  PurpleConnection *gc = (PurpleConnection *) action->context;
+  g_return_if_fail (gc_get_data (gc));
+  tgprpl_xfer_show (gc_get_data (gc));
+}
+
+static void tgprpl_action_show_cache (PurplePluginAction *action) {
+  PurpleConnection *gc = (PurpleConnection *) action->context;
+  g_return_if_fail (gc_get_data (gc));
+  tgp_cache_show (gc);
+}
+
+static void tgprpl_action_bandwidth (PurplePluginAction *action) {
+  PurpleConnection *gc = (PurpleConnection *) action->context;
+  g_return_if_fail (gc_get_data (gc));
+  request_bandwidth_limits (gc_get_tls (gc));
+}
+
 static GList *tgprpl_actions (PurplePlugin *plugin, gpointer context) {
-  return (GList *)NULL;
+  GList *actions = NULL;
+  actions = g_list_append (actions, purple_plugin_action_new (_("Show Message Latency..."),
+      tgprpl_action_show_latency));
+  actions = g_list_append (actions, purple_plugin_action_new (_("Show File Transfers..."),
+      tgprpl_action_show_xfers));
+  actions = g_list_append (actions, purple_plugin_action_new (_("Show Media Cache..."),
+      tgprpl_action_show_cache));
+  actions = g_list_append (actions, purple_plugin_action_new (_("Limit Bandwidth of All Accounts..."),
+      tgprpl_action_bandwidth));
+  return actions;
 }
 
 static PurplePluginInfo plugin_info = {
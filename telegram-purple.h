@@ -56,6 +56,8 @@
 #include "tgp-msg.h"
 #include "tgp-request.h"
 #include "tgp-info.h"
+#include "tgp-trace.h"
+#include "tgp-cache.h"
 #include "msglog.h"
 
 #define PLUGIN_ID "prpl-telegram"
@@ -73,6 +75,21 @@
 #define TGP_DEFAULT_MEDIA_SIZE 32768
 #define TGP_KEY_MEDIA_SIZE "media-size-threshold"
 
+#define TGP_DEFAULT_MEDIA_CONCURRENCY 4
+#define TGP_KEY_MEDIA_CONCURRENCY "media-parallel-loads"
+
+#define TGP_DEFAULT_MEDIA_CACHE_SIZE 256
+#define TGP_KEY_MEDIA_CACHE_SIZE "media-cache-size"
+
+#define TGP_DEFAULT_XFER_CONCURRENCY 1
+#define TGP_KEY_XFER_CONCURRENCY "xfer-parallel-loads"
+
+#define TGP_DEFAULT_XFER_REDOWNLOAD_DAYS 3
+#define TGP_KEY_XFER_REDOWNLOAD_DAYS "xfer-redownload-days"
+
+#define TGP_DEFAULT_XFER_PROGRESS_RATE 4
+#define TGP_KEY_XFER_PROGRESS_RATE "xfer-progress-rate"
+
 #define TGP_KEY_PASSWORD_TWO_FACTOR "password-two-factor"
 
 #define TGP_DEFAULT_ACCEPT_SECRET_CHATS "ask"
@@ -93,15 +110,38 @@
 #define TGP_DEFAULT_SEND_READ_NOTIFICATIONS TRUE
 #define TGP_KEY_SEND_READ_NOTIFICATIONS "send-read-notifications"
 
-#define TGP_DEFAULT_CHANNEL_MEMBERS 200
+#define TGP_DEFAULT_CHANNEL_MEMBERS 1000
 #define TGP_KEY_CHANNEL_MEMBERS "channel-member-count"
 
+#define TGP_DEFAULT_CHANNEL_HISTORY_GAP 1000
+#define TGP_KEY_CHANNEL_HISTORY_GAP "channel-history-gap"
+
+#define TGP_KEY_UPLOAD_LIMIT "upload-limit"
+#define TGP_KEY_DOWNLOAD_LIMIT "download-limit"
+
+#define TGP_PREF_ROOT "/plugins/prpl/telegram"
+#define TGP_PREF_UPLOAD_LIMIT TGP_PREF_ROOT "/upload-limit"
+#define TGP_PREF_DOWNLOAD_LIMIT TGP_PREF_ROOT "/download-limit"
+
 #define TGP_DEFAULT_USE_IPV6 FALSE
 #define TGP_KEY_USE_IPV6 "ipv6"
 
 #define TGP_KEY_RESET_AUTH "reset-authorization"
 
 #define TGP_CHANNEL_HISTORY_LIMIT 100
+#define TGP_CHANNEL_MEMBERS_PAGE 200
+#define TGP_CHANNEL_MEMBERS_DELAY 2
+#define TGP_CHANNEL_LOAD_CONCURRENCY 3
+#define TGP_MSG_CACHE_SIZE 2000
+#define TGP_STICKER_CACHE_SIZE 200
+#define TGP_PENDING_READS_DELAY 1000
+#define TGP_BLIST_PHOTO_BATCH 10
+#define TGP_BLIST_PHOTO_DELAY 500
+#define TGP_STATUS_SWEEP_INTERVAL 3600
+#define TGP_XFER_COPY_CHUNK (1 << 20)
+#define TGP_CACHE_INDEX_DELAY 10
+#define TGP_NET_BULK_BYTES 16384
+#define TGP_XFER_INTERRUPTED_SUFFIX ".tgp-interrupted"
 
 extern const char *pk_path;
 extern const char *user_pk_filename;
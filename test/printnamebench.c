@@ -0,0 +1,102 @@
+/*
+ This file is part of telegram-purple
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+
+ Copyright Matthias Jentsch 2016
+ */
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+#include <purple.h>
+
+#include "../telegram-purple.h"
+
+#define PEERS 100000
+
+// the dummy account schedules saving the account list, which needs timers, but the main loop never runs
+static PurpleEventLoopUiOps eventloop_ops = {
+  g_timeout_add,
+  g_source_remove,
+  NULL,
+  g_source_remove,
+  NULL,
+#if GLIB_CHECK_VERSION(2,14,0)
+  g_timeout_add_seconds,
+#else
+  NULL,
+#endif
+  // padding
+  NULL,
+  NULL,
+  NULL
+};
+
+// Create print names for many peers with the same name, like in large public groups, and measure how long it takes.
+int main (int argc, char **argv) {
+  assert(argc == 2);
+  printf ("Running printnamebench on %s.\n", argv[1]);
+  void *plugin = dlopen (argv[1], RTLD_NOW);
+  if (!plugin) {
+    printf ("Cannot load plugin: %s\n", dlerror ());
+    return 1;
+  }
+
+  struct tgl_state *(*state_alloc) (void) = dlsym (plugin, "tgl_state_alloc");
+  connection_data *(*data_init) (struct tgl_state *, PurpleConnection *, PurpleAccount *) =
+      dlsym (plugin, "connection_data_init");
+  char *(*create_print_name) (struct tgl_state *, tgl_peer_id_t, const char *, const char *, const char *,
+      const char *) = dlsym (plugin, "tgp_blist_create_print_name");
+  void (*lookup_add) (struct tgl_state *, tgl_peer_id_t, const char *) = dlsym (plugin, "tgp_blist_lookup_add");
+  struct tgl_allocator **allocator = dlsym (plugin, "tgl_allocator");
+  assert(state_alloc && data_init && create_print_name && lookup_add && allocator);
+
+  // a dummy account without any settings, so that all account settings use their defaults
+  purple_util_set_user_dir ("test/tmp/user");
+  purple_eventloop_set_ui_ops (&eventloop_ops);
+  purple_signals_init ();
+  PurpleAccount *pa = purple_account_new ("+10000000000", PLUGIN_ID);
+  assert(pa);
+
+  struct tgl_state *TLS = state_alloc ();
+  TLS->ev_base = data_init (TLS, NULL, pa);
+
+  GTimer *timer = g_timer_new ();
+  char *name = NULL;
+  int i;
+  for (i = 1; i <= PEERS; i ++) {
+    if (name) {
+      (*allocator)->free (name, strlen (name) + 1);
+    }
+    name = create_print_name (TLS, TGL_MK_USER (i), "John", "Smith", NULL, NULL);
+    lookup_add (TLS, TGL_MK_USER (i), name);
+  }
+  double elapsed = g_timer_elapsed (timer, NULL);
+
+  printf ("Created %d print names in %.3f s (%.2f us per peer), last name: %s\n", PEERS, elapsed,
+      elapsed * 1e6 / PEERS, name);
+  assert(! strcmp (name, "John Smith #99999"));
+
+  // the same peer must keep its name when it is created again
+  char *again = create_print_name (TLS, TGL_MK_USER (PEERS), "John", "Smith", NULL, NULL);
+  assert(! strcmp (name, again));
+
+  g_timer_destroy (timer);
+  return 0;
+}
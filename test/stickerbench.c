@@ -0,0 +1,160 @@
+/*
+ This file is part of telegram-purple
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+
+ Copyright Matthias Jentsch 2016
+ */
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <purple.h>
+
+#include "../telegram-purple.h"
+
+#ifdef HAVE_LIBWEBP
+#include <webp/decode.h>
+#include <webp/encode.h>
+#endif
+
+#define STICKERS 200
+#define SIZE 512
+
+// Decode, downscale and convert a typical 512x512 sticker many times, and measure how long it takes. The pixel
+// conversions that libwebp does while decoding are compared with doing them in a separate pass.
+int main (int argc, char **argv) {
+  assert(argc == 2);
+  printf ("Running stickerbench on %s.\n", argv[1]);
+#ifndef HAVE_LIBWEBP
+  printf ("Built without libwebp, stickers are not decoded.\n");
+  return 0;
+#else
+  void *plugin = dlopen (argv[1], RTLD_NOW);
+  if (!plugin) {
+    printf ("Cannot load plugin: %s\n", dlerror ());
+    return 1;
+  }
+
+  int (*add_webp) (const char *) = dlsym (plugin, "p2tgl_imgstore_add_with_id_webp");
+  assert(add_webp);
+  purple_imgstore_init ();
+
+  // an opaque disc with a gradient on a transparent background, like most stickers
+  guchar *rgba = g_malloc (SIZE * SIZE * 4);
+  int x, y;
+  for (y = 0; y < SIZE; y ++) {
+    for (x = 0; x < SIZE; x ++) {
+      guchar *p = rgba + (y * SIZE + x) * 4;
+      int inside = (x - SIZE / 2) * (x - SIZE / 2) + (y - SIZE / 2) * (y - SIZE / 2) < (SIZE * 2 / 5) * (SIZE * 2 / 5);
+      p[0] = inside ? x / 2 : 0;
+      p[1] = inside ? y / 2 : 0;
+      p[2] = inside ? (x ^ y) & 0xff : 0;
+      p[3] = inside ? 255 : 0;
+    }
+  }
+  uint8_t *webp = NULL;
+  size_t webp_len = WebPEncodeRGBA (rgba, SIZE, SIZE, SIZE * 4, 80, &webp);
+  assert(webp_len > 0);
+
+  gchar *filename = NULL;
+  int fd = g_file_open_tmp ("stickerbench-XXXXXX.webp", &filename, NULL);
+  assert(fd >= 0);
+  close (fd);
+  gboolean written = g_file_set_contents (filename, (const gchar *) webp, webp_len, NULL);
+  assert(written);
+
+  // decoding alone, as a baseline for the cost of the conversion
+  GTimer *timer = g_timer_new ();
+  int i;
+  for (i = 0; i < STICKERS; i ++) {
+    int w, h;
+    uint8_t *decoded = WebPDecodeRGBA (webp, webp_len, &w, &h);
+    assert(decoded && w == SIZE && h == SIZE);
+    WebPFree (decoded);
+  }
+  double decode = g_timer_elapsed (timer, NULL);
+
+  // converting the byte order in a separate pass after decoding, instead of letting the decoder write BGRA
+  g_timer_start (timer);
+  for (i = 0; i < STICKERS; i ++) {
+    int w, h;
+    uint8_t *decoded = WebPDecodeRGBA (webp, webp_len, &w, &h);
+    assert(decoded);
+    uint8_t *p, *end = decoded + w * h * 4;
+    for (p = decoded; p < end; p += 4) {
+      uint8_t r = p[0];
+      p[0] = p[2];
+      p[2] = r;
+    }
+    WebPFree (decoded);
+  }
+  double swizzle = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  for (i = 0; i < STICKERS; i ++) {
+    int w, h;
+    uint8_t *decoded = WebPDecodeBGRA (webp, webp_len, &w, &h);
+    assert(decoded);
+    WebPFree (decoded);
+  }
+  double bgra = g_timer_elapsed (timer, NULL);
+
+  // scaling to the displayed size while decoding, like the plugin does
+  g_timer_start (timer);
+  for (i = 0; i < STICKERS; i ++) {
+    WebPDecoderConfig config;
+    WebPInitDecoderConfig (&config);
+    config.options.use_scaling = 1;
+    config.options.scaled_width = SIZE / 2;
+    config.options.scaled_height = SIZE / 2;
+    config.output.colorspace = MODE_RGBA;
+    VP8StatusCode status = WebPDecode (webp, webp_len, &config);
+    assert(status == VP8_STATUS_OK);
+    WebPFreeDecBuffer (&config.output);
+  }
+  double scaled = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  size_t png_len = 0;
+  for (i = 0; i < STICKERS; i ++) {
+    int img = add_webp (filename);
+    assert(img > 0);
+    png_len = purple_imgstore_get_size (purple_imgstore_find_by_id (img));
+    purple_imgstore_unref_by_id (img);
+  }
+  double total = g_timer_elapsed (timer, NULL);
+
+  printf ("Decoded %d stickers of %d bytes in %.3f s (%.2f ms per sticker)\n", STICKERS, (int) webp_len, decode,
+      decode * 1e3 / STICKERS);
+  printf ("Decoded to RGBA and swizzled afterwards in %.2f ms, decoded to BGRA in %.2f ms per sticker\n",
+      swizzle * 1e3 / STICKERS, bgra * 1e3 / STICKERS);
+  printf ("Decoded and scaled to %dx%d in %.2f ms per sticker\n", SIZE / 2, SIZE / 2, scaled * 1e3 / STICKERS);
+  printf ("Displayed %d stickers in %.3f s (%.2f ms per sticker), %d bytes per image\n", STICKERS, total,
+      total * 1e3 / STICKERS, (int) png_len);
+
+  g_unlink (filename);
+  g_free (filename);
+  WebPFree (webp);
+  g_free (rgba);
+  g_timer_destroy (timer);
+  return 0;
+#endif
+}
@@ -26,6 +26,7 @@
 
 #ifdef HAVE_LIBPNG
 #include <png.h>
+#include <zlib.h>
 #endif
 
 PurpleAccount *tls_get_pa (struct tgl_state *TLS) {
@@ -138,23 +139,63 @@ PurpleConversation *p2tgl_find_conversation_with_account (struct tgl_state *TLS,
   return conv;
 }
 
-void p2tgl_prpl_got_user_status (struct tgl_state *TLS, tgl_peer_id_t user, struct tgl_user_status *status) {
-  connection_data *data = TLS->ev_base;
-  
+/*
+ Status updates are received for every user, including users that aren't in the buddy list, and most of them don't
+ change the displayed status. The last status passed to libpurple is therefore remembered for each user and only
+ actual changes are propagated. Users that were last seen too long ago are displayed as offline, which is rechecked
+ for all users once every TGP_STATUS_SWEEP_INTERVAL seconds.
+*/
+static const char *p2tgl_user_states[] = { NULL, "available", "mobile", "offline" };
+
+static int p2tgl_user_state (connection_data *conn, tgl_peer_id_t user, struct tgl_user_status *status) {
   if (status->online == 1 || 777000 == tgl_get_peer_id (user)) {
     // 777000 is the magic number for the Telegram system account. It is *always* on the dialogue list.
-    purple_prpl_got_user_status (tls_get_pa (TLS), tgp_blist_lookup_purple_name (TLS, user), "available", NULL);
-  } else {
-    debug ("%d: when=%d", tgl_get_peer_id (user), status->when);
-    if (tgp_time_n_days_ago (
-          purple_account_get_int (data->pa, TGP_KEY_INACTIVE_DAYS_OFFLINE, TGP_DEFAULT_INACTIVE_DAYS_OFFLINE)) > status->when && status->when) {
-      debug ("offline");
-      purple_prpl_got_user_status (tls_get_pa (TLS), tgp_blist_lookup_purple_name (TLS, user), "offline", NULL);
-    } else {
-      debug ("mobile");
-      purple_prpl_got_user_status (tls_get_pa (TLS), tgp_blist_lookup_purple_name (TLS, user), "mobile", NULL);
+    return 1;
+  }
+  if (status->when && status->when < conn->inactive_cutoff) {
+    return 3;
+  }
+  return 2;
+}
+
+void p2tgl_prpl_got_user_status (struct tgl_state *TLS, tgl_peer_id_t user, struct tgl_user_status *status) {
+  connection_data *conn = TLS->ev_base;
+  gpointer key = GINT_TO_POINTER(tgl_get_peer_id (user));
+
+  int state = p2tgl_user_state (conn, user, status);
+  if (GPOINTER_TO_INT(g_hash_table_lookup (conn->user_states, key)) != state) {
+    g_hash_table_replace (conn->user_states, key, GINT_TO_POINTER(state));
+    purple_prpl_got_user_status (tls_get_pa (TLS), tgp_blist_lookup_purple_name (TLS, user),
+        p2tgl_user_states[state], NULL);
+  }
+}
+
+void p2tgl_prpl_user_status_reset (struct tgl_state *TLS, tgl_peer_id_t user) {
+  g_hash_table_remove (tls_get_data (TLS)->user_states, GINT_TO_POINTER(tgl_get_peer_id (user)));
+}
+
+gboolean p2tgl_prpl_user_status_sweep (gpointer data) {
+  connection_data *conn = data;
+  conn->inactive_cutoff = tgp_time_n_days_ago (purple_account_get_int (conn->pa, TGP_KEY_INACTIVE_DAYS_OFFLINE,
+      TGP_DEFAULT_INACTIVE_DAYS_OFFLINE));
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init (&iter, conn->user_states);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    tgl_peer_t *P = tgl_peer_get (conn->TLS, TGL_MK_USER (GPOINTER_TO_INT(key)));
+    if (! P) {
+      continue;
+    }
+    int state = p2tgl_user_state (conn, P->id, &P->user.status);
+    if (state != GPOINTER_TO_INT(value)) {
+      debug ("%d: status changed to %s", tgl_get_peer_id (P->id), p2tgl_user_states[state]);
+      g_hash_table_iter_replace (&iter, GINT_TO_POINTER(state));
+      purple_prpl_got_user_status (conn->pa, tgp_blist_lookup_purple_name (conn->TLS, P->id),
+          p2tgl_user_states[state], NULL);
     }
   }
+  return TRUE;
 }
 
 void p2tgl_conv_add_user (struct tgl_state *TLS, PurpleConversation *conv, int user, char *message, int flags,
@@ -174,9 +215,15 @@ int p2tgl_imgstore_add_with_id (const char* filename) {
   return id;
 }
 
-int p2tgl_imgstore_add_with_id_raw (const unsigned char *raw_bgra, unsigned width, unsigned height) {
+/*
+ Uncompressed TGA images are filled in place: the caller writes its BGRA pixels directly behind the header of
+ the buffer that is handed over to the imgstore, so the bitmap is never copied.
+*/
+#define P2TGL_TGA_HEADER 18
+
+unsigned char *p2tgl_tga_new (unsigned width, unsigned height, unsigned char **pixels) {
   // Heavily inspired by: https://github.com/EionRobb/pidgin-opensteamworks/blob/master/libsteamworks.cpp#L113
-  const unsigned char tga_header[] = {
+  const unsigned char tga_header[P2TGL_TGA_HEADER] = {
       // No ID; no color map; uncompressed true color
       0,0,2,
       // No color map metadata
@@ -190,16 +237,35 @@ int p2tgl_imgstore_add_with_id_raw (const unsigned char *raw_bgra, unsigned widt
       // "Origin in upper left-hand corner"
       32};
   // Will be owned by libpurple imgstore, which uses glib functions for managing memory
-  const unsigned tga_len = sizeof(tga_header) + width * height * 4;
-  unsigned char *tga = g_malloc(tga_len);
-  memcpy(tga, tga_header, sizeof(tga_header));
+  unsigned char *tga = g_malloc (P2TGL_TGA_HEADER + width * height * 4);
+  memcpy (tga, tga_header, P2TGL_TGA_HEADER);
   // From the documentation: "The 4 byte entry contains 1 byte each of blue, green, red, and attribute."
-  memcpy(tga + sizeof(tga_header), raw_bgra, width * height * 4);
-  return purple_imgstore_add_with_id (tga, tga_len, NULL);
+  *pixels = tga + P2TGL_TGA_HEADER;
+  return tga;
+}
+
+int p2tgl_imgstore_add_with_id_tga (unsigned char *tga, unsigned width, unsigned height) {
+  return purple_imgstore_add_with_id (tga, P2TGL_TGA_HEADER + width * height * 4, NULL);
+}
+
+int p2tgl_imgstore_add_with_id_raw (const unsigned char *raw_bgra, unsigned width, unsigned height) {
+  unsigned char *pixels;
+  unsigned char *tga = p2tgl_tga_new (width, height, &pixels);
+  memcpy (pixels, raw_bgra, width * height * 4);
+  return p2tgl_imgstore_add_with_id_tga (tga, width, height);
 }
 
 #ifdef HAVE_LIBPNG
 
+/*
+ The encoded images only live in the imgstore of this process and are never sent anywhere, so encoding speed
+ matters more than size. The fastest zlib level with the cheap SUB filter encodes stickers several times faster
+ than the default settings, which try every filter on every row, and the output is only slightly larger. The
+ rows are written directly from the decoded bitmap, so no row pointer array is needed.
+*/
+#define P2TGL_PNG_LEVEL Z_BEST_SPEED
+#define P2TGL_PNG_FILTER PNG_FILTER_SUB
+
 static void p2tgl_png_mem_write (png_structp png_ptr, png_bytep data, png_size_t length) {
   GByteArray *png_mem = (GByteArray *) png_get_io_ptr(png_ptr);
   g_byte_array_append (png_mem, data, length);
@@ -209,7 +275,6 @@ int p2tgl_imgstore_add_with_id_png (const unsigned char *raw_bitmap, unsigned wi
   GByteArray *png_mem = NULL;
   png_structp png_ptr = NULL;
   png_infop info_ptr = NULL;
-  png_bytepp rows = NULL;
 
   // init png write struct
   png_ptr = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -225,10 +290,14 @@ int p2tgl_imgstore_add_with_id_png (const unsigned char *raw_bitmap, unsigned wi
     warning ("error encoding png (create_info_struct failed)");
     return 0;
   }
-  
+
+  // stickers usually compress to less than a quarter of the bitmap, so this avoids most reallocations
+  png_mem = g_byte_array_sized_new (width * height + 1024);
+
   // Set up error handling.
   if (setjmp(png_jmpbuf(png_ptr))) {
     png_destroy_write_struct(&png_ptr, &info_ptr);
+    g_byte_array_free (png_mem, TRUE);
     warning ("error while writing png");
     return 0;
   }
@@ -237,29 +306,20 @@ int p2tgl_imgstore_add_with_id_png (const unsigned char *raw_bitmap, unsigned wi
   png_set_IHDR (png_ptr, info_ptr, width, height, 
                 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-  
-  // alloc row pointers
-  rows = g_new0 (png_bytep, height);
-  if (rows == NULL) {
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    warning ("error converting to png: malloc failed");
-    return 0;
-  }
-  
-  unsigned i;
-  for (i = 0; i < height; i++)
-    rows[i] = (png_bytep)(raw_bitmap + i * width * 4);
-  
-  // create array and set own png write function
-  png_mem = g_byte_array_new();
+  png_set_compression_level (png_ptr, P2TGL_PNG_LEVEL);
+  png_set_filter (png_ptr, PNG_FILTER_TYPE_BASE, P2TGL_PNG_FILTER);
+
+  // set own png write function
   png_set_write_fn (png_ptr, png_mem, p2tgl_png_mem_write, NULL);
-  
+
   // write png
-  png_set_rows (png_ptr, info_ptr, rows);
-  png_write_png (png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+  png_write_info (png_ptr, info_ptr);
+  unsigned i;
+  for (i = 0; i < height; i++)
+    png_write_row (png_ptr, (png_bytep)(raw_bitmap + i * width * 4));
+  png_write_end (png_ptr, info_ptr);
 
   // cleanup
-  g_free(rows);
   png_destroy_write_struct (&png_ptr, &info_ptr);
   unsigned png_size = png_mem->len;
   gpointer png_data = g_byte_array_free (png_mem, FALSE);
@@ -311,26 +371,39 @@ int p2tgl_imgstore_add_with_id_webp (const char *filename) {
     }
     config.options.use_scaling = 1;
   }
+  // libwebp scales while decoding and converts to the requested byte order itself, both with SIMD code that is
+  // selected at runtime, so the pixels need no further pass before they are stored
 #ifdef HAVE_LIBPNG
   config.output.colorspace = MODE_RGBA;
 #else
+  // decode directly into the TGA buffer that is handed over to the imgstore
+  unsigned char *tga = p2tgl_tga_new (config.options.scaled_width, config.options.scaled_height,
+      &config.output.u.RGBA.rgba);
   config.output.colorspace = MODE_BGRA;
+  config.output.width = config.options.scaled_width;
+  config.output.height = config.options.scaled_height;
+  config.output.u.RGBA.stride = config.options.scaled_width * 4;
+  config.output.u.RGBA.size = config.options.scaled_width * config.options.scaled_height * 4;
+  config.output.is_external_memory = 1;
 #endif
   if (WebPDecode(data, len, &config) != VP8_STATUS_OK) {
     warning ("error decoding webp: %s", filename);
     g_free ((gchar *)data);
+#ifndef HAVE_LIBPNG
+    g_free (tga);
+#endif
     return 0;
   }
   g_free ((gchar *)data);
-  const uint8_t *decoded = config.output.u.RGBA.rgba;
 
   // convert and add
 #ifdef HAVE_LIBPNG
-  int imgStoreId = p2tgl_imgstore_add_with_id_png(decoded, config.options.scaled_width, config.options.scaled_height);
+  int imgStoreId = p2tgl_imgstore_add_with_id_png(config.output.u.RGBA.rgba, config.options.scaled_width,
+      config.options.scaled_height);
+  WebPFreeDecBuffer (&config.output);
 #else
-  int imgStoreId = p2tgl_imgstore_add_with_id_raw(decoded, config.options.scaled_width, config.options.scaled_height);
+  int imgStoreId = p2tgl_imgstore_add_with_id_tga(tga, config.options.scaled_width, config.options.scaled_height);
 #endif
-  WebPFreeDecBuffer (&config.output);
   return imgStoreId;
 }
 #endif
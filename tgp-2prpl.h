@@ -40,11 +40,15 @@ int p2tgl_status_is_present (PurpleStatus *status);
 void tgp_chat_got_in (struct tgl_state *TLS, tgl_peer_t *chat, tgl_peer_id_t who, const char *message, int flags, time_t when);
 void p2tgl_got_im_combo (struct tgl_state *TLS, tgl_peer_id_t who, const char *msg, int flags, time_t when);
 void p2tgl_prpl_got_user_status (struct tgl_state *TLS, tgl_peer_id_t user, struct tgl_user_status *status);
+void p2tgl_prpl_user_status_reset (struct tgl_state *TLS, tgl_peer_id_t user);
+gboolean p2tgl_prpl_user_status_sweep (gpointer data);
 void p2tgl_conv_add_user (struct tgl_state *TLS, PurpleConversation *conv, int user, char *message, int flags, int new_arrival);
 PurpleConversation *p2tgl_find_conversation_with_account (struct tgl_state *TLS, tgl_peer_id_t peer);
 
 int p2tgl_imgstore_add_with_id (const char* filename);
 int p2tgl_imgstore_add_with_id_raw (const unsigned char *raw_rgba, unsigned width, unsigned height);
+unsigned char *p2tgl_tga_new (unsigned width, unsigned height, unsigned char **pixels);
+int p2tgl_imgstore_add_with_id_tga (unsigned char *tga, unsigned width, unsigned height);
 #ifdef HAVE_LIBWEBP
 int p2tgl_imgstore_add_with_id_webp (const char *filename);
 #endif
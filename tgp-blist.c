@@ -17,6 +17,8 @@
  Copyright Matthias Jentsch 2015
  */
 
+#include <string.h>
+
 #include "telegram-purple.h"
 
 // utilities
@@ -36,6 +38,68 @@ PurpleBlistNode *tgp_blist_iterate (struct tgl_state *TLS,
   return NULL;
 }
 
+// index
+
+/*
+ Finding the blist node of a peer is needed on almost every update, therefore all buddies and chats of the account
+ are indexed by their peer type and id. The index is built from a single scan of the blist on first use and kept up
+ to date using the blist-node-added and blist-node-removed signals.
+*/
+static gint64 tgp_blist_index_key (tgl_peer_id_t id) {
+  // users, secret chats, chats and channels may share the same numeric id
+  return ((gint64) tgl_get_peer_type (id) << 32) | (guint32) tgl_get_peer_id (id);
+}
+
+static int tgp_blist_index_get_key (PurpleBlistNode *node, gint64 *key) {
+  tgl_peer_id_t id;
+  if (PURPLE_BLIST_NODE_IS_BUDDY(node) && tgp_blist_buddy_has_id (PURPLE_BUDDY(node))) {
+    id = tgp_blist_buddy_get_id (PURPLE_BUDDY(node));
+  } else if (PURPLE_BLIST_NODE_IS_CHAT(node) && tgp_chat_has_id (PURPLE_CHAT(node))) {
+    id = tgp_chat_get_id (PURPLE_CHAT(node));
+  } else {
+    return FALSE;
+  }
+  if (tgl_get_peer_type (id) == TGL_PEER_UNKNOWN) {
+    return FALSE;
+  }
+  *key = tgp_blist_index_key (id);
+  return TRUE;
+}
+
+static GHashTable *tgp_blist_index_table (struct tgl_state *TLS, PurpleBlistNode *node) {
+  return PURPLE_BLIST_NODE_IS_CHAT(node) ? tls_get_data (TLS)->chat_nodes : tls_get_data (TLS)->buddy_nodes;
+}
+
+void tgp_blist_index_add (struct tgl_state *TLS, PurpleBlistNode *node) {
+  gint64 key;
+  if (tls_get_data (TLS)->blist_indexed && tgp_blist_index_get_key (node, &key)) {
+    g_hash_table_replace (tgp_blist_index_table (TLS, node), g_memdup (&key, sizeof (key)), node);
+  }
+}
+
+void tgp_blist_index_remove (struct tgl_state *TLS, PurpleBlistNode *node) {
+  gint64 key;
+  GHashTable *index = tgp_blist_index_table (TLS, node);
+  if (tgp_blist_index_get_key (node, &key) && g_hash_table_lookup (index, &key) == node) {
+    g_hash_table_remove (index, &key);
+  }
+}
+
+static int tgp_blist_index_init_cb (PurpleBlistNode *node, void *extra) {
+  tgp_blist_index_add (extra, node);
+  return FALSE;
+}
+
+static PurpleBlistNode *tgp_blist_index_find (struct tgl_state *TLS, GHashTable *index, tgl_peer_id_t id) {
+  connection_data *conn = tls_get_data (TLS);
+  if (! conn->blist_indexed) {
+    conn->blist_indexed = TRUE;
+    tgp_blist_iterate (TLS, tgp_blist_index_init_cb, TLS);
+  }
+  gint64 key = tgp_blist_index_key (id);
+  return g_hash_table_lookup (index, &key);
+}
+
 // lookup
 
 const char *tgp_blist_lookup_purple_name (struct tgl_state *TLS, tgl_peer_id_t id) {
@@ -45,21 +109,73 @@ const char *tgp_blist_lookup_purple_name (struct tgl_state *TLS, tgl_peer_id_t i
   return name;
 }
 
+/*
+ To avoid issues with differences in string normalization, all purple names are stored in composed form. This helps
+ to avoid issues with clients like Adium, that will store strings in decomposed format by default. Each name is
+ only stored once in the *purple_names* pool, both look-up tables refer to the pooled strings.
+
+ ASCII strings are never changed by normalization and are used as they are. Names that are passed in a different
+ form are remembered after the first look-up, so that repeated look-ups won't need to allocate memory.
+*/
+static int tgp_blist_lookup_is_ascii (const char *str) {
+  for (; *str; str ++) {
+    if ((unsigned char) *str & 0x80) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static const char *tgp_blist_lookup_intern (connection_data *conn, const char *name) {
+  const char *interned = g_hash_table_lookup (conn->purple_names, name);
+  if (! interned) {
+    char *copy = g_strdup (name);
+    g_hash_table_insert (conn->purple_names, copy, copy);
+    conn->purple_names_size += strlen (copy) + 1;
+    interned = copy;
+  }
+  return interned;
+}
+
 void tgp_blist_lookup_add (struct tgl_state *TLS, tgl_peer_id_t id, const char *purple_name) {
-  
-  // to avoid issues with differences in string normalization, always store in composed form this helps to avoid
-  // issues with clients like Adium, that will store strings in decomposed format by default
-  const char *name = g_utf8_normalize (purple_name, -1, G_NORMALIZE_DEFAULT_COMPOSE);
+  connection_data *conn = tls_get_data (TLS);
+  const char *name;
 
-  g_hash_table_replace (tls_get_data (TLS)->id_to_purple_name, GINT_TO_POINTER(tgl_get_peer_id (id)),
-      g_strdup (name));
-  g_hash_table_replace (tls_get_data (TLS)->purple_name_to_id, g_strdup (name),
-      g_memdup (&id, sizeof(tgl_peer_id_t)));
+  gchar *normalized = NULL;
+  if (! tgp_blist_lookup_is_ascii (purple_name)) {
+    normalized = g_utf8_normalize (purple_name, -1, G_NORMALIZE_DEFAULT_COMPOSE);
+  }
+  name = tgp_blist_lookup_intern (conn, normalized ? normalized : purple_name);
+  g_free (normalized);
+
+  g_hash_table_replace (conn->id_to_purple_name, GINT_TO_POINTER(tgl_get_peer_id (id)), (gpointer) name);
+  g_hash_table_replace (conn->purple_name_to_id, (gpointer) name, g_memdup (&id, sizeof(tgl_peer_id_t)));
 }
 
 static tgl_peer_id_t *tgp_blist_lookup_get_id (struct tgl_state *TLS, const char *purple_name) {
-  return g_hash_table_lookup (tls_get_data (TLS)->purple_name_to_id,
-      g_utf8_normalize (purple_name, -1, G_NORMALIZE_DEFAULT_COMPOSE));
+  connection_data *conn = tls_get_data (TLS);
+
+  tgl_peer_id_t *id = g_hash_table_lookup (conn->purple_name_to_id, purple_name);
+  if (id || tgp_blist_lookup_is_ascii (purple_name)) {
+    return id;
+  }
+
+  gchar *normalized = g_utf8_normalize (purple_name, -1, G_NORMALIZE_DEFAULT_COMPOSE);
+  if (normalized) {
+    id = g_hash_table_lookup (conn->purple_name_to_id, normalized);
+    g_free (normalized);
+  }
+  if (id) {
+    g_hash_table_insert (conn->purple_name_to_id, (gpointer) tgp_blist_lookup_intern (conn, purple_name),
+        g_memdup (id, sizeof(tgl_peer_id_t)));
+  }
+  return id;
+}
+
+void tgp_blist_lookup_report (struct tgl_state *TLS) {
+  connection_data *conn = tls_get_data (TLS);
+  info ("purple name index: %u names, %u ids, %lu bytes of strings", g_hash_table_size (conn->purple_names),
+      g_hash_table_size (conn->id_to_purple_name), (unsigned long) conn->purple_names_size);
 }
 
 tgl_peer_t *tgp_blist_lookup_peer_get (struct tgl_state *TLS, const char *purple_name) {
@@ -89,6 +205,7 @@ static int tgp_blist_lookup_init_cb (PurpleBlistNode *node, void *extra) {
 void tgp_blist_lookup_init (struct tgl_state *TLS) {
   info ("loading known ids from buddy list ...");
   tgp_blist_iterate (TLS, tgp_blist_lookup_init_cb, 0);
+  tgp_blist_lookup_report (TLS);
 }
 
 // buddies
@@ -141,13 +258,8 @@ tgl_peer_t *tgp_blist_buddy_get_peer (PurpleBuddy *buddy) {
   return tgl_peer_get (pbn_get_data (&buddy->node)->TLS, tgp_blist_buddy_get_id (buddy));
 }
 
-static int tgp_blist_buddy_find_cb (PurpleBlistNode *node, void *extra) {
-  return PURPLE_BLIST_NODE_IS_BUDDY(node)
-      && purple_blist_node_get_int (node, TGP_BUDDY_KEY_PEER_ID) == GPOINTER_TO_INT(extra);
-}
-
 PurpleBuddy *tgp_blist_buddy_find (struct tgl_state *TLS, tgl_peer_id_t user) {
-  return (PurpleBuddy *) tgp_blist_iterate (TLS, tgp_blist_buddy_find_cb, GINT_TO_POINTER(tgl_get_peer_id (user)));
+  return (PurpleBuddy *) tgp_blist_index_find (TLS, tls_get_data (TLS)->buddy_nodes, user);
 }
 
 // contacts
@@ -167,21 +279,72 @@ void tgp_blist_contact_add (struct tgl_state *TLS, struct tgl_user *U) {
   p2tgl_prpl_got_user_status (TLS, U->id, &U->status);
 }
 
-// chats
+/*
+ After login all users in the dialogue list are added to the buddy list at once. To keep this from blocking the
+ UI, the buddy list is compared to the dialogue list in a single pass and only missing buddies are added. The
+ avatars of new buddies are loaded in small batches afterwards.
+*/
+static gboolean tgp_blist_photos_load_cb (gpointer data) {
+  connection_data *conn = data;
+
+  int i;
+  for (i = 0; i < TGP_BLIST_PHOTO_BATCH && ! g_queue_is_empty (conn->pending_photos); i ++) {
+    tgl_peer_id_t *id = g_queue_pop_head (conn->pending_photos);
+    tgl_peer_t *P = tgl_peer_get (conn->TLS, *id);
+    PurpleBuddy *buddy = tgp_blist_buddy_find (conn->TLS, *id);
+    if (P && buddy) {
+      tgp_info_update_photo (&buddy->node, P);
+    }
+    g_free (id);
+  }
 
-static int tgp_blist_chat_find_cb (PurpleBlistNode *node, void *extra) {
-  if (PURPLE_BLIST_NODE_IS_CHAT(node)) {
-    PurpleChat *chat = PURPLE_CHAT(node);
-    const char *id = g_hash_table_lookup (purple_chat_get_components (chat), "id");
-    if (id && *id && atoi (id) == GPOINTER_TO_INT(extra)) {
-      return TRUE;
+  if (g_queue_is_empty (conn->pending_photos)) {
+    conn->photo_timer = 0;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void tgp_blist_contacts_add (struct tgl_state *TLS, tgl_peer_id_t peers[], int size) {
+  connection_data *conn = tls_get_data (TLS);
+  PurpleGroup *group = NULL;
+  int added = 0;
+
+  int i;
+  for (i = size - 1; i >= 0; i--) {
+    tgl_peer_t *P = tgl_peer_get (TLS, peers[i]);
+    if (! P) {
+      g_warn_if_reached ();
+      continue;
+    }
+    // our own contact shouldn't show up in our buddy list
+    if (tgl_get_peer_type (P->id) != TGL_PEER_USER || (P->user.flags & TGLUF_DELETED)
+        || tgl_get_peer_id (P->id) == tgl_get_peer_id (TLS->our_id)) {
+      continue;
+    }
+
+    if (! tgp_blist_buddy_find (TLS, P->id)) {
+      if (! group) {
+        group = tgp_blist_group_init (_("Telegram"));
+      }
+      PurpleBuddy *buddy = tgp_blist_buddy_new (TLS, P);
+      purple_blist_add_buddy (buddy, NULL, group, NULL);
+      g_queue_push_tail (conn->pending_photos, g_memdup (&P->id, sizeof(tgl_peer_id_t)));
+      ++ added;
     }
+    p2tgl_prpl_got_user_status (TLS, P->id, &P->user.status);
+  }
+  info ("Added %d new contacts to buddy list", added);
+
+  if (! conn->photo_timer && ! g_queue_is_empty (conn->pending_photos)) {
+    conn->photo_timer = purple_timeout_add (TGP_BLIST_PHOTO_DELAY, tgp_blist_photos_load_cb, conn);
   }
-  return FALSE;
 }
 
+// chats
+
 PurpleChat *tgp_blist_chat_find (struct tgl_state *TLS, tgl_peer_id_t user) {
-  return (PurpleChat *) tgp_blist_iterate (TLS, tgp_blist_chat_find_cb, GINT_TO_POINTER(tgl_get_peer_id (user)));
+  return (PurpleChat *) tgp_blist_index_find (TLS, tls_get_data (TLS)->chat_nodes, user);
 }
 
 // groups
@@ -198,6 +361,31 @@ PurpleGroup *tgp_blist_group_init (const char *name) {
 
 // names
 
+static int tgp_blist_print_name_taken (struct tgl_state *TLS, tgl_peer_id_t id, const char *name) {
+  tgl_peer_id_t *id2 = tgp_blist_lookup_get_id (TLS, name);
+  if (! id2) {
+    tgl_peer_t *tmpP = tgl_peer_get_by_name (TLS, name);
+    if (tmpP) {
+      id2 = &tmpP->id;
+    }
+  }
+  return id2 && tgl_get_peer_id (*id2) != tgl_get_peer_id (id);
+}
+
+static int tgp_blist_print_name_has_base (const char *name, const char *base) {
+  size_t len = strlen (base);
+  if (strncmp (name, base, len) || strncmp (name + len, " #", 2) || ! name[len + 2]) {
+    return FALSE;
+  }
+  const char *c;
+  for (c = name + len + 2; *c; c ++) {
+    if (! g_ascii_isdigit (*c)) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
 char *tgp_blist_create_print_name (struct tgl_state *TLS, tgl_peer_id_t id, const char *a1, const char *a2,
     const char *a3, const char *a4) {
 
@@ -218,35 +406,30 @@ char *tgp_blist_create_print_name (struct tgl_state *TLS, tgl_peer_id_t id, cons
         with the old BlistNode.
      3. Assure that the print name isn't already stored in the peer_by_name_tree.
    */
-  int i = 0;
-  gchar *n = NULL;
-
-  tgl_peer_id_t *id2 = tgp_blist_lookup_get_id (TLS, name);
-  if ( !id2) {
-    tgl_peer_t *tmpP = tgl_peer_get_by_name (TLS, name);
-    if (tmpP) {
-      id2 = &tmpP->id;
-    }
-  }
-
-  while (id2 && tgl_get_peer_id (*id2) != tgl_get_peer_id (id)) {
-    if (n) {
-      g_free (n);
+  if (tgp_blist_print_name_taken (TLS, id, name)) {
+
+    // keep the name that was already assigned to this peer for the same base name
+    const char *current = g_hash_table_lookup (tls_get_data (TLS)->id_to_purple_name,
+        GINT_TO_POINTER(tgl_get_peer_id (id)));
+    if (current && tgp_blist_print_name_has_base (current, name)) {
+      g_free (name);
+      name = g_strdup (current);
+
+    } else {
+
+      // all suffixes below the last assigned one are already taken, since print names are permanent
+      GHashTable *suffixes = tls_get_data (TLS)->print_name_suffixes;
+      int i = GPOINTER_TO_INT(g_hash_table_lookup (suffixes, name));
+      gchar *n = NULL;
+      do {
+        g_free (n);
+        n = g_strdup_printf ("%s #%d", name, ++ i);
+      } while (tgp_blist_print_name_taken (TLS, id, n));
+      debug ("resolving duplicate for %s, assigning: %s", name, n);
+
+      g_hash_table_replace (suffixes, name, GINT_TO_POINTER(i));
+      name = n;
     }
-    n = g_strdup_printf ("%s #%d", name, ++ i);
-    debug ("resolving duplicate for %s, assigning: %s", name, n);
-    
-    id2 = tgp_blist_lookup_get_id (TLS, n);
-    if ( !id2) {
-      tgl_peer_t *tmpP = tgl_peer_get_by_name(TLS, n);
-      if (tmpP) {
-        id2 = &tmpP->id;
-      }
-    }
-  }
-  if (n) {
-    g_free (name);
-    name = n;
   }
 
   // the result is owned and freed by libtgl and must not be allocated by glib functions
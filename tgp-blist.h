@@ -40,6 +40,13 @@ const char *tgp_blist_lookup_purple_name (struct tgl_state *TLS, tgl_peer_id_t i
 void tgp_blist_lookup_add (struct tgl_state *TLS, tgl_peer_id_t id, const char *purple_name);
 tgl_peer_t *tgp_blist_lookup_peer_get (struct tgl_state *TLS, const char *purple_name);
 void tgp_blist_lookup_init (struct tgl_state *TLS);
+void tgp_blist_lookup_report (struct tgl_state *TLS);
+
+/* All buddies and chats of the account are indexed by their peer id, the index must be informed about all nodes
+ that are added to or removed from the buddy list. */
+
+void tgp_blist_index_add (struct tgl_state *TLS, PurpleBlistNode *node);
+void tgp_blist_index_remove (struct tgl_state *TLS, PurpleBlistNode *node);
 
 /* To make this new approach robust to names changes, it is necessary to store the user ID in each
  blist node to allow reliable buddy list look-ups by user ids. */
@@ -53,6 +60,7 @@ PurpleBuddy *tgp_blist_buddy_migrate (struct tgl_state *TLS, PurpleBuddy *buddy,
 PurpleBuddy *tgp_blist_buddy_find (struct tgl_state *TLS, tgl_peer_id_t user);
 
 void tgp_blist_contact_add (struct tgl_state *TLS, struct tgl_user *U);
+void tgp_blist_contacts_add (struct tgl_state *TLS, tgl_peer_id_t peers[], int size);
 
 PurpleChat *tgp_blist_chat_find (struct tgl_state *TLS, tgl_peer_id_t user);
 PurpleGroup *tgp_blist_group_init (const char *name);
@@ -0,0 +1,314 @@
+/*
+ This file is part of telegram-purple
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+
+ Copyright Matthias Jentsch 2016
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "tgp-cache.h"
+
+/*
+ Photos, pictures and stickers that are loaded for display are moved from the download directory of the account
+ into one media cache that is shared by all accounts of the process. Files are named after the id and access hash
+ of the photo or document, so the same sticker or forwarded picture is only stored and loaded once. The cache
+ is limited to the largest budget of all accounts using it and evicts the least recently used files when it
+ grows beyond it. Files that were handed out by tgp_cache_lookup() or tgp_cache_store() are pinned until
+ tgp_cache_unpin() is called once their message was displayed, and are never evicted before. An index file with the
+ size and the last use of every file is loaded on startup, so that the cache directory does not need to be scanned.
+*/
+#define TGP_CACHE_INDEX "index"
+
+struct tgp_cache_entry {
+  char *key;
+  char *name;
+  gint64 size;
+  gint64 used;
+  int pins;
+  GList *link;
+};
+
+static struct {
+  int users;
+  char *dir;
+  gint64 budget;
+  gint64 size;
+  GHashTable *entries;
+  GQueue *lru;
+  guint save_timer;
+  int hits;
+  int misses;
+  gint64 saved;
+} cache;
+
+static void tgp_cache_entry_free (gpointer data) {
+  struct tgp_cache_entry *E = data;
+  g_free (E->key);
+  g_free (E->name);
+  g_free (E);
+}
+
+static struct tgp_cache_entry *tgp_cache_entry_add (const char *key, const char *name, gint64 size, gint64 used) {
+  struct tgp_cache_entry *E = g_new0 (struct tgp_cache_entry, 1);
+  E->key = g_strdup (key);
+  E->name = g_strdup (name);
+  E->size = size;
+  E->used = used;
+
+  g_queue_push_tail (cache.lru, E);
+  E->link = g_queue_peek_tail_link (cache.lru);
+  g_hash_table_replace (cache.entries, E->key, E);
+  cache.size += size;
+  return E;
+}
+
+static void tgp_cache_entry_remove (struct tgp_cache_entry *E, int unlink) {
+  if (unlink) {
+    char *path = g_build_filename (cache.dir, E->name, NULL);
+    g_unlink (path);
+    g_free (path);
+  }
+  cache.size -= E->size;
+  g_queue_delete_link (cache.lru, E->link);
+  g_hash_table_remove (cache.entries, E->key);
+}
+
+static void tgp_cache_index_load (void) {
+  char *path = g_build_filename (cache.dir, TGP_CACHE_INDEX, NULL);
+  gchar *contents = NULL;
+
+  if (g_file_get_contents (path, &contents, NULL, NULL)) {
+    gchar **lines = g_strsplit (contents, "\n", -1);
+    int i;
+    for (i = 0; lines[i]; i ++) {
+      gchar **fields = g_strsplit (lines[i], "\t", 4);
+      if (g_strv_length (fields) == 4 && ! g_hash_table_lookup (cache.entries, fields[0])) {
+        tgp_cache_entry_add (fields[0], fields[1], g_ascii_strtoll (fields[2], NULL, 10),
+            g_ascii_strtoll (fields[3], NULL, 10));
+      }
+      g_strfreev (fields);
+    }
+    g_strfreev (lines);
+    g_free (contents);
+  }
+  g_free (path);
+  info ("media cache %s: %d files, %" G_GINT64_FORMAT " bytes", cache.dir, g_hash_table_size (cache.entries),
+      cache.size);
+}
+
+static void tgp_cache_index_save (void) {
+  GString *str = g_string_new ("");
+  GList *it;
+
+  // most recently used first, which is the order in which the index is loaded into the LRU queue
+  for (it = g_queue_peek_head_link (cache.lru); it != NULL; it = g_list_next (it)) {
+    struct tgp_cache_entry *E = it->data;
+    g_string_append_printf (str, "%s\t%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\n", E->key, E->name, E->size,
+        E->used);
+  }
+
+  char *path = g_build_filename (cache.dir, TGP_CACHE_INDEX, NULL);
+  if (! g_file_set_contents (path, str->str, str->len, NULL)) {
+    warning ("cannot write media cache index %s", path);
+  }
+  g_free (path);
+  g_string_free (str, TRUE);
+}
+
+static gboolean tgp_cache_index_save_cb (gpointer ignored) {
+  cache.save_timer = 0;
+  tgp_cache_index_save ();
+  return FALSE;
+}
+
+static void tgp_cache_changed (void) {
+  if (! cache.save_timer) {
+    cache.save_timer = purple_timeout_add_seconds (TGP_CACHE_INDEX_DELAY, tgp_cache_index_save_cb, NULL);
+  }
+}
+
+static void tgp_cache_evict (void) {
+  GList *it = g_queue_peek_tail_link (cache.lru);
+  while (cache.size > cache.budget && it) {
+    GList *prev = g_list_previous (it);
+    struct tgp_cache_entry *E = it->data;
+    if (! E->pins) {
+      debug ("evicting %s from media cache", E->name);
+      tgp_cache_entry_remove (E, TRUE);
+    }
+    it = prev;
+  }
+}
+
+void tgp_cache_init (const char *dir, gint64 budget) {
+  if (! cache.users ++) {
+    cache.dir = g_strdup (dir);
+    cache.budget = 0;
+    cache.size = 0;
+    cache.entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, tgp_cache_entry_free);
+    cache.lru = g_queue_new ();
+    g_mkdir_with_parents (cache.dir, 0700);
+    tgp_cache_index_load ();
+  }
+  if (budget > cache.budget) {
+    cache.budget = budget;
+    tgp_cache_evict ();
+  }
+}
+
+void tgp_cache_release (void) {
+  g_return_if_fail (cache.users > 0);
+  if (-- cache.users) {
+    return;
+  }
+
+  info ("media cache: %d hits, %d misses, %" G_GINT64_FORMAT " bytes saved", cache.hits, cache.misses,
+      cache.saved);
+  if (cache.save_timer) {
+    purple_timeout_remove (cache.save_timer);
+    cache.save_timer = 0;
+  }
+  tgp_cache_index_save ();
+
+  g_queue_free (cache.lru);
+  g_hash_table_destroy (cache.entries);
+  g_free (cache.dir);
+  memset (&cache, 0, sizeof (cache));
+}
+
+char *tgp_cache_key (struct tgl_message *M) {
+  switch (M->media.type) {
+    case tgl_message_media_photo:
+      if (! M->media.photo) {
+        return NULL;
+      }
+      return g_strdup_printf ("p%" G_GINT64_MODIFIER "x_%" G_GINT64_MODIFIER "x", (gint64) M->media.photo->id,
+          (gint64) M->media.photo->access_hash);
+
+    // other documents are displayed as links into the download directory and must stay there
+    case tgl_message_media_document:
+    case tgl_message_media_video:
+    case tgl_message_media_audio:
+      if (! M->media.document || ! (M->media.document->flags & TGLDF_STICKER
+          || (M->media.document->flags & TGLDF_IMAGE && ! (M->media.document->flags & TGLDF_ANIMATED)))) {
+        return NULL;
+      }
+      return g_strdup_printf ("d%" G_GINT64_MODIFIER "x_%" G_GINT64_MODIFIER "x", (gint64) M->media.document->id,
+          (gint64) M->media.document->access_hash);
+
+    // documents of secret chats are only readable by the participants and must not be shared between accounts
+    default:
+      return NULL;
+  }
+}
+
+char *tgp_cache_lookup (const char *key) {
+  g_return_val_if_fail (cache.users > 0, NULL);
+
+  struct tgp_cache_entry *E = g_hash_table_lookup (cache.entries, key);
+  if (E) {
+    char *path = g_build_filename (cache.dir, E->name, NULL);
+    if (g_file_test (path, G_FILE_TEST_EXISTS)) {
+      E->used = time (NULL);
+      g_queue_unlink (cache.lru, E->link);
+      g_queue_push_head_link (cache.lru, E->link);
+      tgp_cache_changed ();
+
+      ++ E->pins;
+      ++ cache.hits;
+      cache.saved += E->size;
+      return path;
+    }
+    g_free (path);
+
+    // removed from the disk by somebody else
+    tgp_cache_entry_remove (E, FALSE);
+    tgp_cache_changed ();
+  }
+  ++ cache.misses;
+  return NULL;
+}
+
+char *tgp_cache_store (const char *key, const char *filename) {
+  g_return_val_if_fail (cache.users > 0, NULL);
+
+  // another account may have loaded the same file in the meantime, its messages keep their pins
+  int pins = 0;
+  struct tgp_cache_entry *E = g_hash_table_lookup (cache.entries, key);
+  if (E) {
+    pins = E->pins;
+    tgp_cache_entry_remove (E, TRUE);
+  }
+
+  const char *ext = strrchr (filename, '.');
+  if (ext && strchr (ext, G_DIR_SEPARATOR)) {
+    ext = NULL;
+  }
+  char *name = g_strconcat (key, ext, NULL);
+  char *path = g_build_filename (cache.dir, name, NULL);
+
+  GStatBuf st;
+  if (g_stat (filename, &st) < 0 || g_rename (filename, path) < 0) {
+    warning ("cannot move %s into media cache", filename);
+    g_free (name);
+    g_free (path);
+    return NULL;
+  }
+
+  E = tgp_cache_entry_add (key, name, st.st_size, time (NULL));
+  E->pins = pins + 1;
+  g_queue_unlink (cache.lru, E->link);
+  g_queue_push_head_link (cache.lru, E->link);
+  g_free (name);
+
+  tgp_cache_evict ();
+  tgp_cache_changed ();
+  return path;
+}
+
+void tgp_cache_unpin (const char *key) {
+  g_return_if_fail (cache.users > 0);
+
+  struct tgp_cache_entry *E = g_hash_table_lookup (cache.entries, key);
+  if (E && E->pins > 0 && ! -- E->pins) {
+    tgp_cache_evict ();
+  }
+}
+
+void tgp_cache_show (PurpleConnection *gc) {
+  GString *str = g_string_new ("");
+  int total = cache.hits + cache.misses;
+
+  gchar *size = purple_str_size_to_units (cache.size);
+  gchar *budget = purple_str_size_to_units (cache.budget);
+  gchar *saved = purple_str_size_to_units (cache.saved);
+
+  g_string_append_printf (str, _("%d files, %s of %s"), cache.entries ? g_hash_table_size (cache.entries) : 0,
+      size, budget);
+  g_string_append (str, "<br>");
+  g_string_append_printf (str, _("%d of %d look-ups found (%d%%), %s not loaded again"), cache.hits, total,
+      total ? cache.hits * 100 / total : 0, saved);
+
+  g_free (size);
+  g_free (budget);
+  g_free (saved);
+
+  purple_notify_formatted (gc, _("Media Cache"), _("Media Cache"), NULL, str->str, NULL, NULL);
+  g_string_free (str, TRUE);
+}
@@ -0,0 +1,63 @@
+/*
+ This file is part of telegram-purple
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+
+ Copyright Matthias Jentsch 2016
+ */
+
+#ifndef tgp_cache_h
+#define tgp_cache_h
+
+#include "telegram-purple.h"
+
+/**
+ * Open the media cache in the given directory for one more account, allowing it to grow to at least budget bytes
+ */
+void tgp_cache_init (const char *dir, gint64 budget);
+
+/**
+ * Release the media cache for one account, the cache is closed when the last account released it
+ */
+void tgp_cache_release (void);
+
+/**
+ * Return the cache key of the photo or document of a message, or NULL if its content must not be cached
+ */
+char *tgp_cache_key (struct tgl_message *M);
+
+/**
+ * Return the path of the cached file for a key, or NULL if it is not cached. The file is pinned until
+ * tgp_cache_unpin() is called.
+ */
+char *tgp_cache_lookup (const char *key);
+
+/**
+ * Move a loaded file into the cache and return its new path, or NULL if it could not be cached. The file is
+ * pinned until tgp_cache_unpin() is called.
+ */
+char *tgp_cache_store (const char *key, const char *filename);
+
+/**
+ * Release a file returned by tgp_cache_lookup() or tgp_cache_store(), allowing it to be evicted
+ */
+void tgp_cache_unpin (const char *key);
+
+/**
+ * Display the size and the hit rate of the media cache
+ */
+void tgp_cache_show (PurpleConnection *gc);
+
+#endif
@@ -125,11 +125,15 @@ static void tgp_chat_on_loaded_channel_full_joining (struct tgl_state *TLS, void
   tgp_chat_show (TLS, P);
 }
 
-static void tgp_chat_add_all_users (struct tgl_state *TLS, PurpleConversation *conv, tgl_peer_t *P) {
-  debug ("tgp_chat_add_all_users()");
+/*
+ Rejoining a large supergroup would freeze the UI if the whole roster was cleared and added again. Instead the
+ current users of the conversation are compared to the members of the chat and only the differences are applied.
+*/
+static void tgp_chat_update_users (struct tgl_state *TLS, PurpleConversation *conv, tgl_peer_t *P) {
+  debug ("tgp_chat_update_users()");
 
-  GList *users = NULL,
-        *flags = NULL;
+  // purple names are owned by the look-up table and can be used as keys directly
+  GHashTable *wanted = g_hash_table_new (g_str_hash, g_str_equal);
 
   switch (tgl_get_peer_type (P->id)) {
     case TGL_PEER_CHAT: {
@@ -140,8 +144,8 @@ static void tgp_chat_add_all_users (struct tgl_state *TLS, PurpleConversation *c
         struct tgl_chat_user *uid = (C->user_list + i);
         const char *name = tgp_blist_lookup_purple_name (TLS, TGL_MK_USER(uid->user_id));
         if (name) {
-          users = g_list_append (users, g_strdup (name));
-          flags = g_list_append (flags, GINT_TO_POINTER(C->admin_id == uid->user_id ? PURPLE_CBFLAGS_FOUNDER : PURPLE_CBFLAGS_NONE));
+          g_hash_table_insert (wanted, (gpointer) name,
+              GINT_TO_POINTER(C->admin_id == uid->user_id ? PURPLE_CBFLAGS_FOUNDER : PURPLE_CBFLAGS_NONE));
         }
       }
       break;
@@ -149,28 +153,71 @@ static void tgp_chat_add_all_users (struct tgl_state *TLS, PurpleConversation *c
 
     case TGL_PEER_CHANNEL: {
       // fetch users
-      GList *MS = g_hash_table_lookup (tls_get_data (TLS)->channel_members, GINT_TO_POINTER(tgl_get_peer_id (P->id)));
-      
-      while (MS) {
-        struct tgp_channel_member *M = MS->data;
+      struct tgp_channel_members *MS = g_hash_table_lookup (tls_get_data (TLS)->channel_members,
+          GINT_TO_POINTER(tgl_get_peer_id (P->id)));
+      if (! MS) {
+        break;
+      }
+
+      GHashTableIter iter;
+      gpointer value;
+      g_hash_table_iter_init (&iter, MS->members);
+      while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        struct tgp_channel_member *M = value;
         const char *name = tgp_blist_lookup_purple_name (TLS, M->id);
         if (name) {
-          users = g_list_append (users, g_strdup (name));
-          flags = g_list_append (flags, GINT_TO_POINTER(M->flags));
+          g_hash_table_insert (wanted, (gpointer) name, GINT_TO_POINTER(M->flags));
         }
-        MS = g_list_next (MS);
-      };
+      }
       break;
     }
 
     default:
+      g_hash_table_destroy (wanted);
       g_return_if_reached();
       break;
   }
 
-  purple_conv_chat_add_users (PURPLE_CONV_CHAT(conv), users, NULL, flags, FALSE);
-  tgp_g_list_free_full (users, g_free);
-  g_list_free (flags);
+  PurpleConvChat *chat = PURPLE_CONV_CHAT(conv);
+  GList *removed = NULL;
+  GList *U;
+  for (U = purple_conv_chat_get_users (chat); U != NULL; U = g_list_next (U)) {
+    PurpleConvChatBuddy *cb = U->data;
+    const char *name = purple_conv_chat_cb_get_name (cb);
+    gpointer flags;
+    if (! g_hash_table_lookup_extended (wanted, name, NULL, &flags)) {
+      // the chat buddy and its name are freed while removing it
+      removed = g_list_prepend (removed, g_strdup (name));
+      continue;
+    }
+    // typing is not part of the member list and must be kept
+    if ((cb->flags & ~PURPLE_CBFLAGS_TYPING) != GPOINTER_TO_INT(flags)) {
+      purple_conv_chat_user_set_flags (chat, name, GPOINTER_TO_INT(flags) | (cb->flags & PURPLE_CBFLAGS_TYPING));
+    }
+    g_hash_table_remove (wanted, name);
+  }
+
+  GList *users = NULL,
+        *flags = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init (&iter, wanted);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    users = g_list_prepend (users, key);
+    flags = g_list_prepend (flags, value);
+  }
+
+  debug ("roster changes: %d added, %d removed", g_list_length (users), g_list_length (removed));
+  if (removed) {
+    purple_conv_chat_remove_users (chat, removed, NULL);
+    tgp_g_list_free_full (removed, g_free);
+  }
+  if (users) {
+    purple_conv_chat_add_users (chat, users, NULL, flags, FALSE);
+    g_list_free (users);
+    g_list_free (flags);
+  }
+  g_hash_table_destroy (wanted);
 }
 
 PurpleConversation *tgp_chat_show (struct tgl_state *TLS, tgl_peer_t *P) {
@@ -196,9 +243,10 @@ PurpleConversation *tgp_chat_show (struct tgl_state *TLS, tgl_peer_t *P) {
   
   conv = serv_got_joined_chat (tls_get_conn (TLS), tgl_get_peer_id (P->id), name);
   g_return_val_if_fail(conv, NULL);
+  tgp_msg_media_conv_opened (TLS, P->id);
+  tgp_prio_queue_set_open (tls_get_data (TLS)->channel_queue, P->id, TRUE);
 
-  purple_conv_chat_clear_users (purple_conversation_get_chat_data (conv));
-  tgp_chat_add_all_users (TLS, conv, P);
+  tgp_chat_update_users (TLS, conv, P);
 
   return conv;
 }
@@ -501,18 +549,125 @@ static void tgp_channel_loading_free (struct tgp_channel_loading *D) {
   free (D);
 }
 
+/*
+ Supergroups can have many thousand members. Only the first TGP_CHANNEL_MEMBERS_PAGE members are loaded before
+ the channel is displayed, the rest is loaded in the background one page every TGP_CHANNEL_MEMBERS_DELAY
+ seconds, until TGP_KEY_CHANNEL_MEMBERS members are known. Members are stored by their user id, which allows
+ merging the admin list and later pages in constant time per member. Background pages are only requested once the
+ member list is registered in conn->channel_members, and each request carries the generation of the list it was
+ made for, so that a late page of a list that was replaced by a reload in the meantime is dropped.
+*/
+struct tgp_channel_members_page {
+  tgl_peer_id_t id;
+  unsigned generation;
+};
+
+static unsigned tgp_channel_members_generation;
+
+static int tgp_channel_members_limit (struct tgl_state *TLS) {
+  return purple_account_get_int (tls_get_pa (TLS), TGP_KEY_CHANNEL_MEMBERS, TGP_DEFAULT_CHANNEL_MEMBERS);
+}
+
+static struct tgp_channel_members *tgp_channel_members_new (struct tgl_state *TLS, tgl_peer_id_t id) {
+  struct tgp_channel_members *MS = g_new0 (struct tgp_channel_members, 1);
+  MS->TLS = TLS;
+  MS->id = id;
+  MS->members = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  MS->generation = ++ tgp_channel_members_generation;
+  return MS;
+}
+
+void tgp_channel_members_free (gpointer data) {
+  struct tgp_channel_members *MS = data;
+  if (MS->timer) {
+    purple_timeout_remove (MS->timer);
+  }
+  g_hash_table_destroy (MS->members);
+  g_free (MS);
+}
+
+static struct tgp_channel_member *tgp_channel_members_add (struct tgp_channel_members *MS, tgl_peer_id_t id) {
+  gpointer key = GINT_TO_POINTER(tgl_get_peer_id (id));
+  struct tgp_channel_member *M = g_hash_table_lookup (MS->members, key);
+  if (! M) {
+    M = g_new0 (struct tgp_channel_member, 1);
+    M->id = id;
+    g_hash_table_insert (MS->members, key, M);
+  }
+  return M;
+}
+
+static void tgp_channel_members_page_done (struct tgl_state *TLS, void *extra, int success, int users_num,
+      struct tgl_user **users);
+
+static gboolean tgp_channel_members_page_cb (gpointer data) {
+  struct tgp_channel_members *MS = data;
+  MS->timer = 0;
+
+  int count = MIN(TGP_CHANNEL_MEMBERS_PAGE, tgp_channel_members_limit (MS->TLS) - MS->offset);
+  if (count > 0) {
+    debug ("loading members %d to %d of channel %d", MS->offset, MS->offset + count, tgl_get_peer_id (MS->id));
+    struct tgp_channel_members_page *page = g_new0 (struct tgp_channel_members_page, 1);
+    page->id = MS->id;
+    page->generation = MS->generation;
+    tgl_do_channel_get_members (MS->TLS, MS->id, count, MS->offset, 0, tgp_channel_members_page_done, page);
+  }
+  return FALSE;
+}
+
+static void tgp_channel_members_schedule (struct tgp_channel_members *MS) {
+  gpointer ID = GINT_TO_POINTER(tgl_get_peer_id (MS->id));
+  if (g_hash_table_lookup (tls_get_data (MS->TLS)->channel_members, ID) != MS) {
+    return;
+  }
+  if (MS->more && MS->offset < tgp_channel_members_limit (MS->TLS) && ! MS->timer) {
+    MS->timer = purple_timeout_add_seconds (TGP_CHANNEL_MEMBERS_DELAY, tgp_channel_members_page_cb, MS);
+  }
+}
+
+static void tgp_channel_members_next_page (struct tgp_channel_members *MS, int users_num) {
+  MS->offset += users_num;
+  MS->more = users_num >= TGP_CHANNEL_MEMBERS_PAGE;
+  tgp_channel_members_schedule (MS);
+}
+
+static void tgp_channel_members_page_done (struct tgl_state *TLS, void *extra, int success, int users_num,
+      struct tgl_user **users) {
+  struct tgp_channel_members_page *page = extra;
+  struct tgp_channel_members *MS = g_hash_table_lookup (tls_get_data (TLS)->channel_members,
+      GINT_TO_POINTER(tgl_get_peer_id (page->id)));
+  int current = MS && MS->generation == page->generation;
+  g_free (page);
+  if (! current || ! success) {
+    return;
+  }
+
+  PurpleConversation *conv = purple_find_chat (tls_get_conn (TLS), tgl_get_peer_id (MS->id));
+  int i;
+  for (i = 0; i < users_num; i ++) {
+    int known = g_hash_table_lookup (MS->members, GINT_TO_POINTER(tgl_get_peer_id (users[i]->id))) != NULL;
+    tgp_channel_members_add (MS, users[i]->id);
+    if (conv && ! known) {
+      p2tgl_conv_add_user (TLS, conv, tgl_get_peer_id (users[i]->id), NULL, PURPLE_CBFLAGS_NONE, FALSE);
+    }
+  }
+  tgp_channel_members_next_page (MS, users_num);
+}
+
+static void tgp_channel_load_schedule (struct tgl_state *TLS);
+
 static void tgp_channel_load_finish (struct tgl_state *TLS, struct tgp_channel_loading *D, int success) {
   GList *cb = D->callbacks;
   GList *extra = D->extras;
+  -- tls_get_data (TLS)->channels_loading;
 
-  if (! g_list_length (D->members)) {
-    struct tgp_channel_member *M = talloc0 (sizeof(struct tgp_channel_member));
-    M->id = TLS->our_id;
-    D->members = g_list_append (D->members, M);
+  if (! g_hash_table_size (D->members->members)) {
+    tgp_channel_members_add (D->members, TLS->our_id);
   }
 
   g_hash_table_replace (tls_get_data (TLS)->channel_members,
       GINT_TO_POINTER(tgl_get_peer_id (D->P->id)), D->members);
+  tgp_channel_members_schedule (D->members);
 
   while (cb) {
     if (cb->data) {
@@ -523,6 +678,7 @@ static void tgp_channel_load_finish (struct tgl_state *TLS, struct tgp_channel_l
   }
 
   tgp_channel_loading_free (D);
+  tgp_channel_load_schedule (TLS);
 }
 
 static void tgp_channel_load_admins_done (struct tgl_state *TLS, void *extra, int success, int users_num,
@@ -532,20 +688,10 @@ static void tgp_channel_load_admins_done (struct tgl_state *TLS, void *extra, in
   struct tgp_channel_loading *D = extra;
   
   if (success) {
-    GHashTable *HT = g_hash_table_new (g_direct_hash, g_direct_equal);
     int i;
     for (i = 0; i < users_num; i ++) {
-      g_hash_table_insert (HT, GINT_TO_POINTER(tgl_get_peer_id (users[i]->id)), GINT_TO_POINTER(1));
+      tgp_channel_members_add (D->members, users[i]->id)->flags |= PURPLE_CBFLAGS_OP;
     }
-    
-    GList *MS = D->members;
-    do {
-      struct tgp_channel_member *M = MS->data;
-      if (g_hash_table_lookup (HT, GINT_TO_POINTER(tgl_get_peer_id (M->id)))) {
-        M->flags |= PURPLE_CBFLAGS_OP;
-      }
-    } while ((MS = g_list_next (MS)));
-    g_hash_table_destroy (HT);
   }
   
   tgp_channel_load_finish (TLS, D, success);
@@ -563,50 +709,67 @@ static void tgp_channel_get_members_done (struct tgl_state *TLS, void *extra, in
   
   int i;
   for (i = 0; i < users_num; i ++) {
-    struct tgp_channel_member *M = talloc0 (sizeof(struct tgp_channel_member));
-    M->id = users[i]->id;
-    D->members = g_list_append (D->members, M);
+    tgp_channel_members_add (D->members, users[i]->id);
   }
+  tgp_channel_members_next_page (D->members, users_num);
   
-  tgl_do_channel_get_members (TLS, D->P->id,
-      purple_account_get_int (tls_get_pa (TLS), TGP_KEY_CHANNEL_MEMBERS, TGP_DEFAULT_CHANNEL_MEMBERS),
-      0, 1, tgp_channel_load_admins_done, D);
+  tgl_do_channel_get_members (TLS, D->P->id, TGP_CHANNEL_MEMBERS_PAGE, 0, 1, tgp_channel_load_admins_done, D);
 }
 
-static gint tgp_channel_find_higher_id (gconstpointer a, gconstpointer b) {
-  return ((struct tgp_msg_loading *)a)->msg->server_id < GPOINTER_TO_INT(b);
-}
+/*
+ When the newest message of a channel is known, all messages that were missed since the last known server id are
+ fetched in pages of TGP_CHANNEL_HISTORY_LIMIT, oldest first. Each page is passed on for display before the next
+ one is requested, and the last server id is stored after each page, so that an interrupted fill continues where
+ it stopped on the next login. Gaps larger than TGP_KEY_CHANNEL_HISTORY_GAP are only filled with the newest
+ messages.
+*/
+static void tgp_channel_get_history_page (struct tgl_state *TLS, struct tgp_channel_loading *D);
 
 static void tgp_channel_get_history_done (struct tgl_state *TLS, void *extra, int success, int size,
                 struct tgl_message **list) {
   struct tgp_channel_loading *D = extra;
 
   if (success) {
-    if (size > 0 && tgp_chat_get_last_server_id (TLS, D->P->id) < list[size - 1]->server_id) {
+    if (! D->gap_to && size > 0 && tgp_chat_get_last_server_id (TLS, D->P->id) < list[size - 1]->server_id) {
       tgp_chat_set_last_server_id (TLS, D->P->id, (int) list[size - 1]->server_id);
     }
     
-    GList *where = g_queue_find_custom (tls_get_data (TLS)->new_messages,
-                       GINT_TO_POINTER(tgp_chat_get_last_server_id (TLS, D->P->id)), tgp_channel_find_higher_id);
     int i;
     for (i = size - 1; i >= 0; -- i) {
       if (list[i]->server_id > tgp_chat_get_last_server_id (TLS, D->P->id)) {
-        tgp_msg_recv (TLS, list[i], where);
+        tgp_msg_recv (TLS, list[i], TRUE);
+      }
+    }
+
+    if (D->gap_to) {
+      D->gap_from = D->gap_page;
+      if (tgp_chat_get_last_server_id (TLS, D->P->id) < D->gap_from) {
+        tgp_chat_set_last_server_id (TLS, D->P->id, D->gap_from);
+      }
+      if (D->gap_from < D->gap_to) {
+        tgp_channel_get_history_page (TLS, D);
+        return;
       }
     }
   } else {
     g_warn_if_reached(); // gap in history
   }
 
-  if (D->P->flags & (TGLCHF_ADMIN | TGLCHF_MEGAGROUP)) {
-    tgl_do_channel_get_members (TLS, D->P->id,
-        purple_account_get_int (tls_get_pa (TLS), TGP_KEY_CHANNEL_MEMBERS, TGP_DEFAULT_CHANNEL_MEMBERS),
+  if (D->P->flags & (TGLCHF_ADMIN | TGLCHF_MEGAGROUP) && tgp_channel_members_limit (TLS) > 0) {
+    tgl_do_channel_get_members (TLS, D->P->id, MIN(TGP_CHANNEL_MEMBERS_PAGE, tgp_channel_members_limit (TLS)),
         0, 0, tgp_channel_get_members_done, extra);
   } else {
     tgp_channel_load_finish (TLS, D, success);
   }
 }
 
+static void tgp_channel_get_history_page (struct tgl_state *TLS, struct tgp_channel_loading *D) {
+  D->gap_page = MIN(D->gap_from + TGP_CHANNEL_HISTORY_LIMIT, D->gap_to);
+  debug ("fetching history of channel %d from %d to %d", tgl_get_peer_id (D->P->id), D->gap_from, D->gap_page);
+  tgl_do_get_history_range (TLS, D->P->id, D->gap_from, D->gap_page + 1, TGP_CHANNEL_HISTORY_LIMIT,
+      tgp_channel_get_history_done, D);
+}
+
 void tgp_channel_load (struct tgl_state *TLS, tgl_peer_t *P,
         void (*callback) (struct tgl_state *, void *, int, tgl_peer_t *),
         void *extra) {
@@ -617,13 +780,39 @@ void tgp_channel_load (struct tgl_state *TLS, tgl_peer_t *P,
     
     struct tgp_channel_loading *D = talloc0 (sizeof(struct tgp_channel_loading));
     D->P = P;
+    D->members = tgp_channel_members_new (TLS, P->id);
     D->callbacks = g_list_append (NULL, callback);
     D->extras = g_list_append (NULL, extra);
     D->remaining = 2;
-
-    tgl_do_get_history_range (TLS, P->id, (int) tgp_chat_get_last_server_id (TLS, P->id), 0,
-        TGP_CHANNEL_HISTORY_LIMIT, tgp_channel_get_history_done, D);
     g_hash_table_replace (tls_get_data (TLS)->pending_channels, ID, D);
+    ++ tls_get_data (TLS)->channels_loading;
+
+    // the newest message in this channel is read and older than the history retrieval threshold, therefore the
+    // history doesn't contain anything that would be displayed and doesn't need to be transferred at all
+    if (P->last && ! (P->last->flags & TGLMF_UNREAD) && P->last->date
+        && P->last->date < tgp_msg_oldest_relevant_ts (TLS)) {
+      debug ("channel %d has no relevant history, skipping history fetch", tgl_get_peer_id (P->id));
+      tgp_channel_get_history_done (TLS, D, TRUE, 0, NULL);
+      return;
+    }
+
+    int last = tgp_chat_get_last_server_id (TLS, P->id);
+    if (last && P->last && P->last->server_id > last) {
+      int max_gap = purple_account_get_int (tls_get_pa (TLS), TGP_KEY_CHANNEL_HISTORY_GAP,
+          TGP_DEFAULT_CHANNEL_HISTORY_GAP);
+      D->gap_from = last;
+      D->gap_to = (int) P->last->server_id;
+      if (max_gap > 0 && D->gap_to - D->gap_from > max_gap) {
+        info ("skipping %d missed messages in channel %d", D->gap_to - D->gap_from - max_gap,
+            tgl_get_peer_id (P->id));
+        D->gap_from = D->gap_to - max_gap;
+        tgp_chat_set_last_server_id (TLS, P->id, D->gap_from);
+      }
+      tgp_channel_get_history_page (TLS, D);
+      return;
+    }
+
+    tgl_do_get_history_range (TLS, P->id, last, 0, TGP_CHANNEL_HISTORY_LIMIT, tgp_channel_get_history_done, D);
 
   } else {
     if (! tgp_channel_loaded (TLS, P->id)) {
@@ -641,6 +830,44 @@ int tgp_channel_loaded (struct tgl_state *TLS, tgl_peer_id_t id) {
              GINT_TO_POINTER(tgl_get_peer_id (id)));
 }
 
+/*
+ Loading a channel takes up to three requests, loading all channels of the dialogue list at once after login would
+ therefore often exceed the flood limits. Channels that have unread messages or an open conversation are queued and
+ loaded at most TGP_CHANNEL_LOAD_CONCURRENCY at once, open conversations and the most unread messages first. All
+ other channels are only loaded once they receive a message or are joined.
+*/
+static void tgp_channel_load_schedule (struct tgl_state *TLS) {
+  connection_data *conn = tls_get_data (TLS);
+
+  struct tgp_channel_queued *Q;
+  while (conn->channels_loading < TGP_CHANNEL_LOAD_CONCURRENCY && (Q = tgp_prio_queue_pop (conn->channel_queue))) {
+    tgl_peer_t *P = tgl_peer_get (TLS, Q->id);
+    if (P && ! tgp_channel_loaded (TLS, Q->id)
+        && ! g_hash_table_lookup (conn->pending_channels, GINT_TO_POINTER(tgl_get_peer_id (Q->id)))) {
+      debug ("loading channel %d with %d unread messages", tgl_get_peer_id (Q->id), Q->unread);
+      tgp_channel_load (TLS, P, NULL, NULL);
+    }
+    g_free (Q);
+  }
+}
+
+void tgp_channel_load_queue (struct tgl_state *TLS, tgl_peer_id_t id, int unread) {
+  connection_data *conn = tls_get_data (TLS);
+  int open = purple_find_chat (tls_get_conn (TLS), tgl_get_peer_id (id)) != NULL;
+
+  if (! unread && ! open) {
+    debug ("channel %d has no unread messages, loading it on demand", tgl_get_peer_id (id));
+    return;
+  }
+
+  struct tgp_channel_queued *Q = g_new0 (struct tgp_channel_queued, 1);
+  Q->id = id;
+  Q->unread = unread;
+  tgp_prio_queue_push (conn->channel_queue, id, open, unread, Q);
+
+  tgp_channel_load_schedule (TLS);
+}
+
 static void update_chat (struct tgl_state *TLS, tgl_peer_t *C, unsigned flags, const char *group) {
   if (flags & TGL_UPDATE_CREATED) {
     tgp_blist_lookup_add (TLS, C->id, C->print_name);
@@ -28,12 +28,30 @@ struct tgp_channel_member {
   int flags;
 };
 
+struct tgp_channel_members {
+  struct tgl_state *TLS;
+  tgl_peer_id_t id;
+  GHashTable *members;
+  int offset;
+  int more;
+  unsigned generation;
+  guint timer;
+};
+
+struct tgp_channel_queued {
+  tgl_peer_id_t id;
+  int unread;
+};
+
 struct tgp_channel_loading {
   tgl_peer_t *P;
-  GList *members;
+  struct tgp_channel_members *members;
   GList *callbacks;
   GList *extras;
   int remaining;
+  int gap_from;
+  int gap_page;
+  int gap_to;
 };
 
 tgl_peer_id_t tgp_chat_get_id (PurpleChat *C);
@@ -61,6 +79,8 @@ void tgp_channel_load (struct tgl_state *TLS, tgl_peer_t *P,
          void (*callback) (struct tgl_state *, void *, int, tgl_peer_t *),
          void *extra);
 int tgp_channel_loaded (struct tgl_state *TLS, tgl_peer_id_t id);
+void tgp_channel_load_queue (struct tgl_state *TLS, tgl_peer_id_t id, int unread);
+void tgp_channel_members_free (gpointer data);
 
 void update_channel_handler (struct tgl_state *TLS, struct tgl_channel *C, unsigned flags);
 void update_chat_handler (struct tgl_state *TLS, struct tgl_chat *C, unsigned flags);
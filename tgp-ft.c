@@ -18,8 +18,21 @@
  Copyright Matthias Jentsch 2014-2015
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glib/gstdio.h>
 
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#  include <sys/syscall.h>
+#endif
+
+#ifndef O_BINARY
+#  define O_BINARY 0
+#endif
+
 #include "telegram-purple.h"
 
 static void tgprpl_xfer_free_data (struct tgp_xfer_send_data *data);
@@ -59,40 +72,261 @@ static char *tgp_strdup_determine_filename (const char *mime, const char *captio
   return g_strdup_printf ("%" G_GINT64_MODIFIER "d.%s", (gint64) ABS(hash), type);
 }
 
-static void tgprpl_xfer_recv_on_finished (struct tgl_state *TLS, void *_data, int success, const char *filename) {
-  debug ("tgprpl_xfer_recv_on_finished()");
-  struct tgp_xfer_send_data *data = _data;
-  char *selected = g_strdup (purple_xfer_get_local_filename (data->xfer));
+/*
+  Downloads of documents that were accepted but did not complete before the account went offline
+  are recorded in a small key file next to the libtgl downloads, named after the permanent id of
+  the message. The record only holds the message id and the selected target, no file data:
+  libtgl always loads a document from its start and cannot continue a partial download. After the
+  next login the user is asked whether each interrupted download should be started again from the
+  beginning. Records are removed when the download completes, is canceled or declined, and dropped
+  when they are older than TGP_KEY_XFER_REDOWNLOAD_DAYS. Secret chat documents cannot be fetched
+  again and are never recorded.
+*/
+#define TGP_XFER_INTERRUPTED_GROUP "download"
+
+static char *tgprpl_xfer_record_path (struct tgl_state *TLS, tgl_message_id_t *id) {
+  char *name = g_strdup_printf ("%u_%u_%" G_GINT64_FORMAT TGP_XFER_INTERRUPTED_SUFFIX, id->peer_type, id->peer_id,
+      (gint64) id->id);
+  char *path = get_download_path (TLS, name);
+  g_free (name);
+  return path;
+}
 
-  if (success) {
-    debug ("purple_xfer_set_completed");
+static void tgprpl_xfer_record_save (struct tgp_xfer_send_data *data) {
+  struct tgl_message *M = data->msg;
+
+  if (M->media.type == tgl_message_media_document_encr
+      || purple_account_get_int (data->conn->pa, TGP_KEY_XFER_REDOWNLOAD_DAYS, TGP_DEFAULT_XFER_REDOWNLOAD_DAYS) <= 0) {
+    return;
+  }
+
+  g_free (data->record);
+  data->record = tgprpl_xfer_record_path (data->conn->TLS, &M->permanent_id);
+
+  // keep the creation date of a download that is started again
+  GKeyFile *K = g_key_file_new ();
+  if (! g_key_file_load_from_file (K, data->record, G_KEY_FILE_NONE, NULL)) {
+    g_key_file_set_int64 (K, TGP_XFER_INTERRUPTED_GROUP, "created", time (NULL));
+  }
+  g_key_file_set_integer (K, TGP_XFER_INTERRUPTED_GROUP, "peer_type", M->permanent_id.peer_type);
+  g_key_file_set_integer (K, TGP_XFER_INTERRUPTED_GROUP, "peer_id", M->permanent_id.peer_id);
+  g_key_file_set_int64 (K, TGP_XFER_INTERRUPTED_GROUP, "id", M->permanent_id.id);
+  g_key_file_set_int64 (K, TGP_XFER_INTERRUPTED_GROUP, "access_hash", M->permanent_id.access_hash);
+  g_key_file_set_string (K, TGP_XFER_INTERRUPTED_GROUP, "target", purple_xfer_get_local_filename (data->xfer));
+
+  gsize length = 0;
+  gchar *contents = g_key_file_to_data (K, &length, NULL);
+  if (! g_file_set_contents (data->record, contents, length, NULL)) {
+    warning ("cannot write interrupted download record %s", data->record);
+  }
+  g_free (contents);
+  g_key_file_free (K);
+}
+
+static void tgprpl_xfer_record_remove (struct tgp_xfer_send_data *data) {
+  if (data->record) {
+    g_unlink (data->record);
+    g_free (data->record);
+    data->record = NULL;
+  }
+}
+
+static void tgprpl_xfer_recv_release (struct tgp_xfer_send_data *data) {
+  data->loading = FALSE;
+
+  data->xfer->data = NULL;
+  purple_xfer_unref (data->xfer);
+  tgprpl_xfer_free_data (data);
+}
+
+static void tgprpl_xfer_recv_completed (struct tgp_xfer_send_data *data) {
+  debug ("purple_xfer_set_completed");
+  tgprpl_xfer_record_remove (data);
+
+  // always completed the file transfer to avoid a warning dialogue when closing (Adium)
+  purple_xfer_set_bytes_sent (data->xfer, purple_xfer_get_size (data->xfer));
+  purple_xfer_set_completed (data->xfer, TRUE);
+
+  if (! purple_xfer_is_canceled (data->xfer)) {
+    purple_xfer_end (data->xfer);
+  }
+  tgprpl_xfer_recv_release (data);
+}
+
+static void tgprpl_xfer_copy_free (struct tgp_xfer_copy *copy) {
+  if (copy->timer) {
+    purple_timeout_remove (copy->timer);
+  }
+  if (copy->in >= 0) {
+    close (copy->in);
+  }
+  if (copy->out >= 0) {
+    close (copy->out);
+  }
+  g_free (copy->from);
+  g_free (copy->to);
+  g_free (copy);
+}
 
-    // always completed the file transfer to avoid a warning dialogue when closing (Adium)
-    purple_xfer_set_bytes_sent (data->xfer, purple_xfer_get_size (data->xfer));
-    purple_xfer_set_completed (data->xfer, TRUE);
+static void tgprpl_xfer_copy_done (struct tgp_xfer_send_data *data, int success) {
+  struct tgp_xfer_copy *copy = data->copy;
+  copy->timer = 0;
 
+  if (success) {
+    g_unlink (copy->from);
+  } else {
+    g_unlink (copy->to);
     if (! purple_xfer_is_canceled (data->xfer)) {
-      purple_xfer_end (data->xfer);
+      char *msg = g_strdup_printf (_("Moving the downloaded file to %s failed, it was kept as %s."), copy->to,
+          copy->from);
+      purple_xfer_error (PURPLE_XFER_RECEIVE, data->conn->pa, purple_xfer_get_remote_user (data->xfer), msg);
+      purple_xfer_cancel_local (data->xfer);
+      g_free (msg);
     }
+  }
+
+  data->copy = NULL;
+  tgprpl_xfer_copy_free (copy);
+
+  if (success) {
+    tgprpl_xfer_recv_completed (data);
   } else {
+    tgprpl_xfer_recv_release (data);
+  }
+}
+
+static gssize tgprpl_xfer_copy_chunk (struct tgp_xfer_copy *copy, gsize len) {
+  gssize n;
+
+#if defined(__linux__) && defined(__NR_copy_file_range)
+  if (! copy->no_copy_range) {
+    loff_t in_off = copy->offset, out_off = copy->offset;
+    n = syscall (__NR_copy_file_range, copy->in, &in_off, copy->out, &out_off, len, 0);
+    if (n >= 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)) {
+      return n;
+    }
+    copy->no_copy_range = TRUE;
+  }
+#endif
+
+  if (lseek (copy->out, copy->offset, SEEK_SET) < 0) {
+    return -1;
+  }
+
+#ifdef __linux__
+  if (! copy->no_sendfile) {
+    off_t in_off = copy->offset;
+    n = sendfile (copy->out, copy->in, &in_off, len);
+    if (n >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+      return n;
+    }
+    copy->no_sendfile = TRUE;
+  }
+#endif
+
+  char buf[65536];
+  if (lseek (copy->in, copy->offset, SEEK_SET) < 0) {
+    return -1;
+  }
+  n = read (copy->in, buf, MIN(len, sizeof (buf)));
+  gssize written = 0;
+  while (written < n) {
+    gssize w = write (copy->out, buf + written, n - written);
+    if (w < 0) {
+      return -1;
+    }
+    written += w;
+  }
+  return n;
+}
+
+static gboolean tgprpl_xfer_copy_step (gpointer _data) {
+  struct tgp_xfer_send_data *data = _data;
+  struct tgp_xfer_copy *copy = data->copy;
+
+  if (purple_xfer_is_canceled (data->xfer)) {
+    debug ("xfer canceled, aborting copy to %s", copy->to);
+    tgprpl_xfer_copy_done (data, FALSE);
+    return FALSE;
+  }
+
+  off_t end = MIN(copy->offset + TGP_XFER_COPY_CHUNK, copy->size);
+  while (copy->offset < end) {
+    gssize n = tgprpl_xfer_copy_chunk (copy, end - copy->offset);
+    if (n <= 0) {
+      warning ("copying %s to %s failed at offset %lld: %s", copy->from, copy->to, (long long) copy->offset,
+          n < 0 ? g_strerror (errno) : "unexpected end of file");
+      tgprpl_xfer_copy_done (data, FALSE);
+      return FALSE;
+    }
+    copy->offset += n;
+  }
+
+  purple_xfer_set_bytes_sent (data->xfer, copy->offset);
+  purple_xfer_update_progress (data->xfer);
+
+  if (copy->offset >= copy->size) {
+    debug ("copied %lld bytes to %s", (long long) copy->offset, copy->to);
+    tgprpl_xfer_copy_done (data, TRUE);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/*
+  Downloads are stored in the libtgl download directory and moved to the target the user
+  selected once they are complete. When the target is on another file system and cannot be
+  renamed, the file is copied in chunks of TGP_XFER_COPY_CHUNK bytes with copy_file_range,
+  sendfile or plain reads and writes, in that order. One chunk is copied per timer tick so that
+  the event loop keeps running even when the target is slow, and the transfer shows the progress
+  of the copy until it completes.
+*/
+static void tgprpl_xfer_recv_move (struct tgp_xfer_send_data *data, const char *from, const char *to) {
+  debug ("moving transferred file from tgl directory %s to selected target %s", from, to);
+
+  g_unlink (to);
+  if (g_rename (from, to) == 0) {
+    tgprpl_xfer_recv_completed (data);
+    return;
+  }
+  debug ("renaming %s failed (%s), copying", from, g_strerror (errno));
+
+  struct tgp_xfer_copy *copy = g_new0 (struct tgp_xfer_copy, 1);
+  copy->from = g_strdup (from);
+  copy->to = g_strdup (to);
+  copy->in = g_open (from, O_RDONLY | O_BINARY, 0);
+  copy->out = g_open (to, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+  data->copy = copy;
+
+  struct stat st;
+  if (copy->in < 0 || copy->out < 0 || fstat (copy->in, &st) < 0) {
+    warning ("cannot copy %s to %s: %s", from, to, g_strerror (errno));
+    tgprpl_xfer_copy_done (data, FALSE);
+    return;
+  }
+  copy->size = st.st_size;
+
+  purple_xfer_set_bytes_sent (data->xfer, 0);
+  purple_xfer_update_progress (data->xfer);
+  copy->timer = purple_timeout_add (0, tgprpl_xfer_copy_step, data);
+}
+
+static void tgprpl_xfer_recv_on_finished (struct tgl_state *TLS, void *_data, int success, const char *filename) {
+  debug ("tgprpl_xfer_recv_on_finished()");
+  struct tgp_xfer_send_data *data = _data;
+
+  if (! success) {
     tgp_notify_on_error_gw (TLS, NULL, success);
     if (! purple_xfer_is_canceled (data->xfer)) {
       purple_xfer_cancel_remote (data->xfer);
     }
     failure ("recv xfer failed");
+    tgprpl_xfer_recv_release (data);
+    return;
   }
 
-  data->loading = FALSE;
-
-  data->xfer->data = NULL;
-  purple_xfer_unref (data->xfer);
-  tgprpl_xfer_free_data (data);
-
-  debug ("moving transferred file from tgl directory %s to selected target %s", selected, filename);
-  g_unlink (selected);
-  
-  //FIXME: try to copy when this fails
-  g_rename (filename, selected);
+  char *selected = g_strdup (purple_xfer_get_local_filename (data->xfer));
+  tgprpl_xfer_recv_move (data, filename, selected);
   g_free (selected);
 }
 
@@ -126,6 +360,7 @@ static void tgprpl_xfer_send_on_finished (struct tgl_state *TLS, void *_data, in
 static void tgprpl_xfer_canceled (PurpleXfer *X) {
   debug ("tgprpl_xfer_canceled()");
   struct tgp_xfer_send_data *data = X->data;
+  tgprpl_xfer_record_remove (data);
 
   // the xfer data must not be freed when the transfer is still running, since there is no way to cancel
   // the running transfer and the callback still needs the xfer data. In that case transfer data will
@@ -136,66 +371,249 @@ static void tgprpl_xfer_canceled (PurpleXfer *X) {
   }
 }
 
-static gboolean tgprpl_xfer_upload_progress (gpointer _data) {
-  PurpleXfer *X = _data;
-  struct tgp_xfer_send_data *data = X->data;
-  connection_data *conn = data->conn;
+/*
+  libtgl only counts the bytes of all running uploads or downloads of an account together and has
+  no progress callback for a single transfer. The counters only contain the bytes of transfers
+  that are still running in libtgl, so they are exact for a transfer that is the only one running
+  in its direction. Transfers running in parallel in the same direction are assumed to progress
+  at the same pace, and get the share of the counters that matches their size. Such progress is
+  marked as estimated and labelled so in the transfer list. The progress is updated by a single
+  timer per connection that runs while transfers are active, and the UI only when a transfer made
+  progress, at most as often per second as configured with TGP_KEY_XFER_PROGRESS_RATE.
+*/
+static int tgprpl_xfer_running (connection_data *conn, PurpleXferType type) {
+  int running = 0;
+  GList *it;
+  for (it = conn->xfers; it != NULL; it = g_list_next (it)) {
+    struct tgp_xfer_send_data *data = it->data;
+
+    // completed downloads that are still being copied are no longer loaded by libtgl
+    if (! data->copy && purple_xfer_get_type (data->xfer) == type) {
+      ++ running;
+    }
+  }
+  return running;
+}
 
-  PurpleXferType type = purple_xfer_get_type (X);
-  switch (type) {
-    case PURPLE_XFER_SEND:
-      purple_xfer_set_size (X, conn->TLS->cur_uploading_bytes);
-      purple_xfer_set_bytes_sent (X, conn->TLS->cur_uploaded_bytes);
-      purple_xfer_update_progress (X);
-
-      debug ("PURPLE_XFER_SEND progress %d / %d", conn->TLS->cur_uploaded_bytes, conn->TLS->cur_uploading_bytes);
-      if (conn->TLS->cur_uploaded_bytes == conn->TLS->cur_uploading_bytes) {
-        data->timer = 0;
-        return FALSE;
-      }
-      break;
+static void tgprpl_xfer_progress_update (gpointer _data, gpointer extra) {
+  struct tgp_xfer_send_data *data = _data;
+  struct tgl_state *TLS = data->conn->TLS;
+  PurpleXfer *X = data->xfer;
+  long long done, total;
 
-    case PURPLE_XFER_RECEIVE:
-      purple_xfer_set_size (X, conn->TLS->cur_downloading_bytes);
-      purple_xfer_set_bytes_sent (X, conn->TLS->cur_downloaded_bytes);
-      purple_xfer_update_progress (X);
+  // the progress of copying a completed download is reported by the copy itself
+  if (purple_xfer_is_canceled (X) || data->copy) {
+    return;
+  }
+  if (purple_xfer_get_type (X) == PURPLE_XFER_SEND) {
+    done = TLS->cur_uploaded_bytes;
+    total = TLS->cur_uploading_bytes;
+  } else {
+    done = TLS->cur_downloaded_bytes;
+    total = TLS->cur_downloading_bytes;
+  }
 
-      debug ("PURPLE_XFER_RECEIVE progress %d / %d", conn->TLS->cur_downloaded_bytes, conn->TLS->cur_downloading_bytes);
-      if (conn->TLS->cur_downloading_bytes == conn->TLS->cur_downloaded_bytes) {
-        data->timer = 0;
-        return FALSE;
-      }
-      break;
+  // must neither complete the transfer before libtgl reports it as finished nor move backwards
+  long long size = purple_xfer_get_size (X);
+  if (total <= 0) {
+    return;
+  }
+  long long bytes;
+  data->estimated = tgprpl_xfer_running (data->conn, purple_xfer_get_type (X)) > 1;
+  if (data->estimated) {
+    bytes = (long long) ((double) size * done / total);
+  } else {
+    bytes = done - (total - size);
+  }
+  if (bytes <= 0) {
+    return;
+  }
+  if (size && bytes >= size) {
+    bytes = size - 1;
+  }
+  if ((size_t) bytes <= data->bytes) {
+    return;
+  }
+  data->bytes = (size_t) bytes;
+  purple_xfer_set_bytes_sent (X, data->bytes);
+  purple_xfer_update_progress (X);
+}
 
-    default:
-    case PURPLE_XFER_UNKNOWN:
-      failure ("ERROR: tgprpl_xfer_upload_progress xfer type PURPLE_XFER_UNKNOWN.");
-      return FALSE;
-      break;
+static gboolean tgprpl_xfer_progress (gpointer _data) {
+  connection_data *conn = _data;
+  if (! conn->xfers) {
+    conn->xfer_timer = 0;
+    return FALSE;
   }
+  g_list_foreach (conn->xfers, tgprpl_xfer_progress_update, NULL);
   return TRUE;
 }
 
-static void tgprpl_xfer_recv_init (PurpleXfer *X) {
-  debug ("tgprpl_xfer_recv_init(): receiving xfer accepted.");
-
-  struct tgp_xfer_send_data *data = X->data;
-  struct tgl_state *TLS = data->conn->TLS;
-  struct tgl_message *M = data->msg;
-  struct tgl_document *D = M->media.document;
-  tgl_peer_t *P = NULL;
+/*
+  Transfers are accepted in any number, but only TGP_KEY_XFER_CONCURRENCY uploads and as many
+  downloads are passed to libtgl at the same time. Accepted transfers wait in
+  conn->xfer_queue in the order they were accepted and show up as started with no progress
+  until a running transfer finishes or is freed. Running transfers are kept in conn->xfers,
+  with the start time that is needed to compute their rate.
+*/
+static int tgprpl_xfer_concurrency (connection_data *conn) {
+  int max = purple_account_get_int (conn->pa, TGP_KEY_XFER_CONCURRENCY, TGP_DEFAULT_XFER_CONCURRENCY);
+  return max > 0 ? max : 1;
+}
 
-  purple_xfer_start (X, -1, NULL, 0);
-  const char *who = purple_xfer_get_remote_user (X);
-  P = tgp_blist_lookup_peer_get (TLS, who);
-  g_return_if_fail(P);
+static void tgprpl_xfer_start (struct tgp_xfer_send_data *data) {
+  connection_data *conn = data->conn;
 
   // Prevent the xfer data from getting freed after cancelling to allow the file transfer to complete
   // without crashing. This is necessary cause loading the file in libtgl cannot be aborted once started.
-  purple_xfer_ref (X);
+  purple_xfer_ref (data->xfer);
 
-  data->timer = purple_timeout_add (100, tgprpl_xfer_upload_progress, X);
   data->loading = TRUE;
+  data->started = g_get_monotonic_time ();
+  conn->xfers = g_list_append (conn->xfers, data);
+
+  int rate = purple_account_get_int (conn->pa, TGP_KEY_XFER_PROGRESS_RATE, TGP_DEFAULT_XFER_PROGRESS_RATE);
+  if (rate > 0 && ! conn->xfer_timer) {
+    conn->xfer_timer = purple_timeout_add (1000 / MIN(rate, 1000), tgprpl_xfer_progress, conn);
+  }
+
+  data->load (data);
+}
+
+static int tgprpl_xfer_active (connection_data *conn, PurpleXferType type) {
+  int active = 0;
+  GList *it;
+  for (it = conn->xfers; it != NULL; it = g_list_next (it)) {
+    if (purple_xfer_get_type (((struct tgp_xfer_send_data *) it->data)->xfer) == type) {
+      ++ active;
+    }
+  }
+  return active;
+}
+
+static void tgprpl_xfer_schedule (connection_data *conn) {
+  int max = tgprpl_xfer_concurrency (conn);
+  GList *it = conn->xfer_queue;
+  while (it) {
+    struct tgp_xfer_send_data *data = it->data;
+    if (tgprpl_xfer_active (conn, purple_xfer_get_type (data->xfer)) < max) {
+      conn->xfer_queue = g_list_delete_link (conn->xfer_queue, it);
+      tgprpl_xfer_start (data);
+
+      // starting may fail right away and schedule again, which changes the queue
+      it = conn->xfer_queue;
+    } else {
+      it = g_list_next (it);
+    }
+  }
+}
+
+static void tgprpl_xfer_enqueue (struct tgp_xfer_send_data *data) {
+  connection_data *conn = data->conn;
+
+  conn->xfer_queue = g_list_append (conn->xfer_queue, data);
+  debug ("queued xfer %s, %d running, %d queued", purple_xfer_get_filename (data->xfer),
+      g_list_length (conn->xfers), g_list_length (conn->xfer_queue));
+  tgprpl_xfer_schedule (conn);
+}
+
+static void tgprpl_xfer_stop (struct tgp_xfer_send_data *data) {
+  connection_data *conn = data->conn;
+
+  conn->xfer_queue = g_list_remove (conn->xfer_queue, data);
+  if (! g_list_find (conn->xfers, data)) {
+    return;
+  }
+
+  conn->xfers = g_list_remove (conn->xfers, data);
+  if (! conn->xfers && conn->xfer_timer) {
+    purple_timeout_remove (conn->xfer_timer);
+    conn->xfer_timer = 0;
+  }
+  tgprpl_xfer_schedule (conn);
+}
+
+/*
+  The rate and remaining time of a transfer follow from its progress since it was passed to libtgl,
+  and are estimates as well while other transfers run in the same direction.
+*/
+static double tgprpl_xfer_rate (struct tgp_xfer_send_data *data, gint64 now) {
+  if (now <= data->started) {
+    return 0;
+  }
+  return (double) data->bytes * G_USEC_PER_SEC / (now - data->started);
+}
+
+void tgprpl_xfer_show (connection_data *conn) {
+  struct tgl_state *TLS = conn->TLS;
+  GString *str = g_string_new ("");
+  gint64 now = g_get_monotonic_time ();
+  GList *it;
+
+  for (it = conn->xfers; it != NULL; it = g_list_next (it)) {
+    struct tgp_xfer_send_data *data = it->data;
+    PurpleXfer *X = data->xfer;
+    size_t size = purple_xfer_get_size (X);
+    double rate = tgprpl_xfer_rate (data, now);
+
+    gchar *name = g_markup_escape_text (purple_xfer_get_filename (X) ? purple_xfer_get_filename (X) : "?", -1);
+    gchar *done_str = purple_str_size_to_units (data->bytes);
+    gchar *size_str = purple_str_size_to_units (size);
+    gchar *rate_str = purple_str_size_to_units ((size_t) rate);
+    g_string_append_printf (str, "%s %s: %s / %s, %s/s", purple_xfer_get_type (X) == PURPLE_XFER_SEND ? "&uarr;"
+        : "&darr;", name, done_str, size_str, rate_str);
+    if (rate >= 1 && size > data->bytes) {
+      g_string_append_printf (str, _(", %d s remaining"), (int) ((size - data->bytes) / rate));
+    }
+    if (data->estimated) {
+      g_string_append (str, _(" (estimated)"));
+    }
+    g_string_append (str, "<br>");
+    g_free (name);
+    g_free (done_str);
+    g_free (size_str);
+    g_free (rate_str);
+  }
+
+  gchar *up_done = purple_str_size_to_units (TLS->cur_uploaded_bytes);
+  gchar *up_total = purple_str_size_to_units (TLS->cur_uploading_bytes);
+  gchar *down_done = purple_str_size_to_units (TLS->cur_downloaded_bytes);
+  gchar *down_total = purple_str_size_to_units (TLS->cur_downloading_bytes);
+  gchar *summary = g_strdup_printf (_("%d running, %d queued<br>Upload: %s / %s, download: %s / %s<br><br>"),
+      g_list_length (conn->xfers), g_list_length (conn->xfer_queue), up_done, up_total, down_done, down_total);
+  g_string_prepend (str, summary);
+  g_free (summary);
+  g_free (up_done);
+  g_free (up_total);
+  g_free (down_done);
+  g_free (down_total);
+
+  struct tgp_net_bucket *sent = &conn->buckets[tgp_net_up], *received = &conn->buckets[tgp_net_down];
+  gchar *sent_str = purple_str_size_to_units (sent->total);
+  gchar *sent_rate = purple_str_size_to_units ((size_t) sent->throughput);
+  gchar *received_str = purple_str_size_to_units (received->total);
+  gchar *received_rate = purple_str_size_to_units ((size_t) received->throughput);
+  g_string_append_printf (str, _("<br>Network: %s sent (%s/s), %s received (%s/s)"), sent_str, sent_rate,
+      received_str, received_rate);
+  g_free (sent_str);
+  g_free (sent_rate);
+  g_free (received_str);
+  g_free (received_rate);
+
+  purple_notify_formatted (conn->gc, _("File Transfers"), _("File Transfers"), NULL, str->str, NULL, NULL);
+  g_string_free (str, TRUE);
+}
+
+/*
+  libtgl loads a document as one sequential stream of parts into a file it opens itself and has no
+  interface to request byte ranges or to use more than one session per DC for it, so a single
+  document cannot be split up here. Several documents are loaded in parallel instead, up to
+  TGP_KEY_XFER_CONCURRENCY (see tgprpl_xfer_schedule()).
+*/
+static void tgprpl_xfer_recv_load (struct tgp_xfer_send_data *data) {
+  struct tgl_state *TLS = data->conn->TLS;
+  struct tgl_message *M = data->msg;
+  struct tgl_document *D = M->media.document;
 
   switch (M->media.type) {
     case tgl_message_media_document:
@@ -220,6 +638,33 @@ static void tgprpl_xfer_recv_init (PurpleXfer *X) {
   }
 }
 
+static void tgprpl_xfer_recv_init (PurpleXfer *X) {
+  debug ("tgprpl_xfer_recv_init(): receiving xfer accepted.");
+
+  struct tgp_xfer_send_data *data = X->data;
+  struct tgl_state *TLS = data->conn->TLS;
+  tgl_peer_t *P = NULL;
+
+  purple_xfer_start (X, -1, NULL, 0);
+  const char *who = purple_xfer_get_remote_user (X);
+  P = tgp_blist_lookup_peer_get (TLS, who);
+  g_return_if_fail(P);
+
+  data->load = tgprpl_xfer_recv_load;
+  tgprpl_xfer_record_save (data);
+  tgprpl_xfer_enqueue (data);
+}
+
+static void tgprpl_xfer_send_load (struct tgp_xfer_send_data *data) {
+  unsigned long long int flags = TGL_SEND_MSG_FLAG_DOCUMENT_AUTO;
+  if (tgl_get_peer_type (data->peer) == TGL_PEER_CHANNEL) {
+    flags |= TGLMF_POST_AS_CHANNEL;
+  }
+
+  tgl_do_send_document (data->conn->TLS, data->peer, (char*) purple_xfer_get_local_filename (data->xfer),
+      NULL, 0, flags, tgprpl_xfer_send_on_finished, data);
+}
+
 static void tgprpl_xfer_send_init (PurpleXfer *X) {
   debug ("tgprpl_xfer_send_init(): sending xfer accepted.");
 
@@ -245,19 +690,9 @@ static void tgprpl_xfer_send_init (PurpleXfer *X) {
     return;
   }
 
-  unsigned long long int flags = TGL_SEND_MSG_FLAG_DOCUMENT_AUTO;
-  if (tgl_get_peer_type (P->id) == TGL_PEER_CHANNEL) {
-    flags |= TGLMF_POST_AS_CHANNEL;
-  }
-
-  // see comment in tgprpl_xfer_recv_init()
-  purple_xfer_ref (X);
-
-  data->timer = purple_timeout_add (100, tgprpl_xfer_upload_progress, X);
-  data->loading = TRUE;
-
-  tgl_do_send_document (data->conn->TLS, P->id, (char*) localfile, NULL, 0,
-      flags, tgprpl_xfer_send_on_finished, data);
+  data->peer = P->id;
+  data->load = tgprpl_xfer_send_load;
+  tgprpl_xfer_enqueue (data);
 }
 
 static void tgprpl_xfer_init_data (PurpleXfer *X, connection_data *conn, struct tgl_message *msg) {
@@ -271,14 +706,20 @@ static void tgprpl_xfer_init_data (PurpleXfer *X, connection_data *conn, struct
 }
 
 static void tgprpl_xfer_free_data (struct tgp_xfer_send_data *data) {
-  if (data->timer) {
-    purple_input_remove (data->timer);
+  if (data->copy) {
+    g_unlink (data->copy->to);
+    tgprpl_xfer_copy_free (data->copy);
   }
-  data->timer = 0;
+  tgprpl_xfer_stop (data);
+  g_free (data->record);
   g_free (data);
 }
 
 void tgprpl_xfer_free_all (connection_data *conn) {
+  // queued transfers have not been passed to libtgl yet and must not start while going offline
+  g_list_free (conn->xfer_queue);
+  conn->xfer_queue = NULL;
+
   GList *xfers = purple_xfers_get_all ();
   while (xfers) {
     PurpleXfer *xfer = xfers->data;
@@ -286,6 +727,13 @@ void tgprpl_xfer_free_all (connection_data *conn) {
     if (purple_xfer_get_account (xfer) == conn->pa) {
       debug ("xfer: %s", xfer->filename);
 
+      // keep the records of unfinished downloads to offer them again after the next login
+      struct tgp_xfer_send_data *pending = xfer->data;
+      if (pending && pending->record) {
+        g_free (pending->record);
+        pending->record = NULL;
+      }
+
       // cancel all non-completed file tranfsers to avoid them from being called
       // in future sessions, as they still contain references to already freed data.
       if (! purple_xfer_is_canceled (xfer) && ! purple_xfer_is_completed (xfer)) {
@@ -332,10 +780,7 @@ static PurpleXfer *tgprpl_new_xfer_recv (PurpleConnection *gc, const char *who)
   return X;
 }
 
-void tgprpl_recv_file (PurpleConnection *gc, const char *who, struct tgl_message *M) {
-  debug ("tgprpl_recv_file()");
-  g_return_if_fail (who);
-
+static PurpleXfer *tgprpl_xfer_recv_prepare (PurpleConnection *gc, const char *who, struct tgl_message *M) {
   PurpleXfer *X = tgprpl_new_xfer_recv (gc, who);
   const char *mime_type, *caption;
   long long access_hash;
@@ -361,7 +806,118 @@ void tgprpl_recv_file (PurpleConnection *gc, const char *who, struct tgl_message
 
   purple_xfer_set_size (X, size);
   tgprpl_xfer_init_data (X, purple_connection_get_protocol_data (gc), M);
-  purple_xfer_request (X);
+  return X;
+}
+
+void tgprpl_recv_file (PurpleConnection *gc, const char *who, struct tgl_message *M) {
+  debug ("tgprpl_recv_file()");
+  g_return_if_fail (who);
+
+  purple_xfer_request (tgprpl_xfer_recv_prepare (gc, who, M));
+}
+
+struct tgp_xfer_interrupted {
+  struct tgl_state *TLS;
+  struct tgl_message *M;
+  char *who;
+  char *target;
+  char *path;
+};
+
+static void tgprpl_xfer_interrupted_free (struct tgp_xfer_interrupted *D) {
+  g_free (D->who);
+  g_free (D->target);
+  g_free (D->path);
+  g_free (D);
+}
+
+static void tgprpl_xfer_interrupted_accept (struct tgp_xfer_interrupted *D) {
+  info ("downloading %s again", D->target);
+  purple_xfer_request_accepted (tgprpl_xfer_recv_prepare (tls_get_conn (D->TLS), D->who, D->M), D->target);
+  tgprpl_xfer_interrupted_free (D);
+}
+
+static void tgprpl_xfer_interrupted_decline (struct tgp_xfer_interrupted *D) {
+  g_unlink (D->path);
+  tgprpl_xfer_interrupted_free (D);
+}
+
+static void tgprpl_xfer_interrupted_on_message (struct tgl_state *TLS, void *extra, int success,
+    struct tgl_message *M) {
+  char *path = extra;
+
+  GKeyFile *K = g_key_file_new ();
+  char *target = NULL;
+  if (g_key_file_load_from_file (K, path, G_KEY_FILE_NONE, NULL)) {
+    target = g_key_file_get_string (K, TGP_XFER_INTERRUPTED_GROUP, "target", NULL);
+  }
+  g_key_file_free (K);
+
+  const char *who = (success && M) ? tgp_blist_lookup_purple_name (TLS, M->from_id) : NULL;
+  if (! target || ! who || (M->media.type != tgl_message_media_document && M->media.type != tgl_message_media_audio
+      && M->media.type != tgl_message_media_video)) {
+    warning ("cannot download %s again, message not available", path);
+    g_unlink (path);
+    g_free (target);
+    g_free (path);
+    return;
+  }
+
+  struct tgp_xfer_interrupted *D = g_new0 (struct tgp_xfer_interrupted, 1);
+  D->TLS = TLS;
+  D->M = M;
+  D->who = g_strdup (who);
+  D->target = target;
+  D->path = path;
+
+  char *size = purple_str_size_to_units (M->media.document->size);
+  char *basename = g_path_get_basename (target);
+  gchar *message = g_strdup_printf (_("The download of '%s' (%s) from %s was interrupted."), basename, size, who);
+  purple_request_accept_cancel (tls_get_conn (TLS), _("Interrupted download"), message, _("The download cannot "
+      "continue where it stopped. Download the whole file again from the beginning?"), 0, tls_get_pa (TLS), who,
+      NULL, D, G_CALLBACK(tgprpl_xfer_interrupted_accept), G_CALLBACK(tgprpl_xfer_interrupted_decline));
+  g_free (message);
+  g_free (basename);
+  g_free (size);
+}
+
+void tgprpl_xfer_offer_interrupted (struct tgl_state *TLS) {
+  connection_data *conn = tls_get_data (TLS);
+  int days = purple_account_get_int (conn->pa, TGP_KEY_XFER_REDOWNLOAD_DAYS, TGP_DEFAULT_XFER_REDOWNLOAD_DAYS);
+
+  GDir *dir = g_dir_open (conn->download_dir, 0, NULL);
+  if (! dir) {
+    return;
+  }
+
+  const char *name;
+  while ((name = g_dir_read_name (dir))) {
+    if (! g_str_has_suffix (name, TGP_XFER_INTERRUPTED_SUFFIX)) {
+      continue;
+    }
+    char *path = g_build_filename (conn->download_dir, name, NULL);
+
+    GKeyFile *K = g_key_file_new ();
+    int valid = g_key_file_load_from_file (K, path, G_KEY_FILE_NONE, NULL)
+        && g_key_file_has_key (K, TGP_XFER_INTERRUPTED_GROUP, "target", NULL);
+    gint64 created = g_key_file_get_int64 (K, TGP_XFER_INTERRUPTED_GROUP, "created", NULL);
+
+    if (! valid || days <= 0 || created < time (NULL) - (gint64) days * 86400) {
+      info ("dropping interrupted download record %s", name);
+      g_unlink (path);
+      g_free (path);
+    } else {
+      tgl_message_id_t id;
+      id.peer_type = g_key_file_get_integer (K, TGP_XFER_INTERRUPTED_GROUP, "peer_type", NULL);
+      id.peer_id = g_key_file_get_integer (K, TGP_XFER_INTERRUPTED_GROUP, "peer_id", NULL);
+      id.id = g_key_file_get_int64 (K, TGP_XFER_INTERRUPTED_GROUP, "id", NULL);
+      id.access_hash = g_key_file_get_int64 (K, TGP_XFER_INTERRUPTED_GROUP, "access_hash", NULL);
+
+      tgl_do_get_message (TLS, &id, tgprpl_xfer_interrupted_on_message, path);
+    }
+    g_key_file_free (K);
+  }
+  g_dir_close (dir);
 }
 
 void tgprpl_send_file (PurpleConnection * gc, const char *who, const char *file) {
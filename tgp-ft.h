@@ -31,4 +31,15 @@ void tgprpl_send_file (PurpleConnection * gc, const char *who, const char *file)
 void tgprpl_recv_file (PurpleConnection * gc, const char *who, struct tgl_message *M);
 void tgprpl_xfer_free_all (connection_data *conn);
 
+/**
+ * Ask whether downloads that were still running when the account went offline should be started again,
+ * and drop expired ones
+ */
+void tgprpl_xfer_offer_interrupted (struct tgl_state *TLS);
+
+/**
+ * Show the running and queued file transfers with their progress, rate and the total throughput
+ */
+void tgprpl_xfer_show (connection_data *conn);
+
 #endif
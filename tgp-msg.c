@@ -490,16 +490,55 @@ static char *tgp_msg_photo_display (struct tgl_state *TLS, const char *filename,
   }
 }
 
-static char *tgp_msg_sticker_display (struct tgl_state *TLS, tgl_peer_id_t from, const char *filename, int *flags) {
+#ifdef HAVE_LIBWEBP
+/*
+ Popular stickers are sent over and over again, especially in groups. Decoding, scaling and encoding them is
+ by far the most expensive part of displaying them, so the resulting image is kept in the imgstore and
+ remembered by the id of the sticker document. The cache holds one reference to each of the last
+ TGP_STICKER_CACHE_SIZE stickers, every displayed message holds another one in conn->used_images.
+*/
+static int tgp_msg_sticker_img (struct tgl_state *TLS, long long id, const char *filename) {
+  connection_data *conn = TLS->ev_base;
+
+  struct tgp_sticker_entry *E = g_hash_table_lookup (conn->stickers, &id);
+  if (E) {
+    g_queue_unlink (conn->stickers_lru, E->lru_link);
+    g_queue_push_head_link (conn->stickers_lru, E->lru_link);
+    return E->img;
+  }
+
+  int img = p2tgl_imgstore_add_with_id_webp (filename);
+  if (img <= 0) {
+    return img;
+  }
+
+  E = g_new0 (struct tgp_sticker_entry, 1);
+  E->id = id;
+  E->img = img;
+  g_queue_push_head (conn->stickers_lru, E);
+  E->lru_link = g_queue_peek_head_link (conn->stickers_lru);
+  g_hash_table_replace (conn->stickers, &E->id, E);
+
+  while (g_queue_get_length (conn->stickers_lru) > TGP_STICKER_CACHE_SIZE) {
+    struct tgp_sticker_entry *old = g_queue_pop_tail (conn->stickers_lru);
+    g_hash_table_remove (conn->stickers, &old->id);
+  }
+  return img;
+}
+#endif
+
+static char *tgp_msg_sticker_display (struct tgl_state *TLS, tgl_peer_id_t from, long long id, const char *filename,
+    int *flags) {
   char *text = NULL;
   
 #ifdef HAVE_LIBWEBP
   connection_data *conn = TLS->ev_base;
-  int img = p2tgl_imgstore_add_with_id_webp ((char *) filename);
+  int img = tgp_msg_sticker_img (TLS, id, filename);
   if (img <= 0) {
     failure ("Cannot display sticker, adding to imgstore failed");
     return NULL;
   }
+  purple_imgstore_ref_by_id (img);
   used_images_add (conn, img);
   text = tgp_format_img (img);
   *flags |= PURPLE_MESSAGE_IMAGES;
@@ -603,6 +642,38 @@ static char *tgp_msg_reply_display (struct tgl_state *TLS, tgl_peer_t *replyee,
   return value;
 }
 
+static char *tgp_msg_media_placeholder (struct tgl_message *M) {
+  switch (M->media.type) {
+    case tgl_message_media_photo:
+      return g_strdup (_("[photo]"));
+
+    case tgl_message_media_audio:
+      return g_strdup (_("[audio]"));
+
+    case tgl_message_media_video:
+      return g_strdup (_("[video]"));
+
+    case tgl_message_media_document:
+      if (M->media.document->flags & TGLDF_STICKER) {
+        return g_strdup (_("[sticker]"));
+      }
+      if (M->media.document->flags & TGLDF_IMAGE) {
+        return g_strdup (_("[photo]"));
+      }
+      return g_strdup (_("[document]"));
+
+    case tgl_message_media_document_encr:
+      if (M->media.encr_document->flags & TGLDF_STICKER) {
+        return g_strdup (_("[sticker]"));
+      }
+      return g_strdup (_("[document]"));
+
+    default:
+      g_warn_if_reached();
+      return NULL;
+  }
+}
+
 static void tgp_msg_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
   struct tgl_message *M = C->msg;
   char *text = NULL;
@@ -661,6 +732,9 @@ static void tgp_msg_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
   if (M->flags & TGLMF_SERVICE) {
     text = tgp_msg_service_display (TLS, M);
     flags |= PURPLE_MESSAGE_SYSTEM;
+  } else if (C->media_deferred) {
+    // the content is still queued for loading and will be displayed separately once it is available
+    text = tgp_msg_media_placeholder (M);
   } else
     switch (M->media.type) {
       case tgl_message_media_none:
@@ -681,7 +755,7 @@ static void tgp_msg_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
       case tgl_message_media_audio:
         if (M->media.document->flags & TGLDF_STICKER) {
           g_return_if_fail(C->data != NULL);
-          text = tgp_msg_sticker_display (TLS, M->from_id, C->data, &flags);
+          text = tgp_msg_sticker_display (TLS, M->from_id, M->media.document->id, C->data, &flags);
 
         } else if (M->media.document->flags & TGLDF_IMAGE && !(M->media.document->flags & TGLDF_ANIMATED)) {
           g_return_if_fail(C->data != NULL);
@@ -737,7 +811,7 @@ static void tgp_msg_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
       case tgl_message_media_document_encr:
         if (M->media.encr_document->flags & TGLDF_STICKER) {
           g_return_if_fail(C->data != NULL);
-          text = tgp_msg_sticker_display (TLS, M->from_id, C->data, &flags);
+          text = tgp_msg_sticker_display (TLS, M->from_id, M->media.encr_document->id, C->data, &flags);
 
         } if (M->media.encr_document->flags & TGLDF_IMAGE) {
           g_return_if_fail(C->data != NULL);
@@ -797,7 +871,9 @@ static void tgp_msg_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
         break;
     }
 
-  text = tgp_msg_add_media_caption(text, M); //add media caption if present
+  if (! C->media_only) {
+    text = tgp_msg_add_media_caption(text, M); //add media caption if present
+  }
 
   if (tgl_get_peer_type (M->to_id) != TGL_PEER_ENCR_CHAT
       && tgl_get_peer_type (M->to_id) != TGL_PEER_CHANNEL
@@ -814,7 +890,7 @@ static void tgp_msg_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
   }
 
   // forwarded messages
-  if (tgl_get_peer_type (M->fwd_from_id) != TGL_PEER_UNKNOWN) {
+  if (! C->media_only && tgl_get_peer_type (M->fwd_from_id) != TGL_PEER_UNKNOWN) {
     debug("forwarded message: fwd_from_id=%d", tgl_get_peer_id(M->fwd_from_id));
     
     // may be NULL
@@ -835,7 +911,7 @@ static void tgp_msg_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
   }
   
   // replys
-  if (M->reply_id) {
+  if (! C->media_only && M->reply_id) {
     debug("message reply: reply_id=%d", M->reply_id);
     
     tgl_message_id_t msg_id = M->permanent_id;
@@ -891,11 +967,9 @@ static void tgp_msg_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
   g_free (text);
 }
 
-static time_t tgp_msg_oldest_relevant_ts (struct tgl_state *TLS) {
+time_t tgp_msg_oldest_relevant_ts (struct tgl_state *TLS) {
   connection_data *conn = TLS->ev_base;
-  int days = purple_account_get_int (conn->pa, TGP_KEY_HISTORY_RETRIEVAL_THRESHOLD,
-      TGP_DEFAULT_HISTORY_RETRIEVAL_THRESHOLD);
-  return days > 0 ? tgp_time_n_days_ago (days) : 0;
+  return conn->history_days > 0 ? tgp_time_n_days_ago (conn->history_days) : 0;
 }
 
 static void tgp_msg_process_in_ready (struct tgl_state *TLS) {
@@ -907,8 +981,12 @@ static void tgp_msg_process_in_ready (struct tgl_state *TLS) {
       break;
     }
     g_queue_pop_head (conn->new_messages);
+    if (C->channel_iter) {
+      g_sequence_remove (C->channel_iter);
+    }
     
     tgp_msg_display (TLS, C);
+    tgp_trace_display (TLS, C);
     pending_reads_add (TLS, C->msg);
 
     if (C->data) {
@@ -921,28 +999,185 @@ static void tgp_msg_process_in_ready (struct tgl_state *TLS) {
     
     tgp_msg_loading_free (C);
   }
-  pending_reads_send_all (TLS);
+  pending_reads_schedule (TLS);
 
   debug ("tgp_msg_process_in_ready, queue size=%d", g_queue_get_length (conn->new_messages));
 }
 
+/*
+ Loading embedded content is limited to TGP_KEY_MEDIA_CONCURRENCY parallel downloads, to avoid flooding the
+ download data center with hundreds of requests after reconnecting. Messages whose content can be loaded right away
+ are held back until it is available and displayed inline. All other messages are displayed immediately with a
+ placeholder, so that they don't block the queue, and their content is displayed separately once loaded. Queued
+ content is loaded with the open conversations and the newest messages first.
+*/
+static int tgp_msg_media_concurrency (struct tgl_state *TLS) {
+  int max = purple_account_get_int (tls_get_pa (TLS), TGP_KEY_MEDIA_CONCURRENCY, TGP_DEFAULT_MEDIA_CONCURRENCY);
+  return max > 0 ? max : 1;
+}
+
+static tgl_peer_id_t tgp_msg_conv_peer (struct tgl_state *TLS, struct tgl_message *M) {
+  if (tgl_get_peer_type (M->to_id) == TGL_PEER_USER && ! tgp_our_msg (TLS, M)) {
+    return M->from_id;
+  }
+  return M->to_id;
+}
+
+static void tgp_msg_media_schedule (struct tgl_state *TLS);
+
 static void tgp_msg_on_loaded_document (struct tgl_state *TLS, void *extra, int success, const char *filename) {
   debug ("tgp_msg_on_loaded_document()");
  
-  struct tgp_msg_loading *C = extra;
-  
-  if (success) {
-    C->data = (void *) g_strdup (filename);
+  struct tgp_media_load *L = extra;
+  struct tgp_msg_loading *C = L->C;
+  -- tls_get_data (TLS)->media_loading;
+
+  // cached files stay pinned until their message was displayed, so that they cannot be evicted before
+  char *cached = NULL;
+  if (success && L->cache_key && ! L->pinned) {
+    cached = tgp_cache_store (L->cache_key, filename);
+    if (cached) {
+      filename = cached;
+      L->pinned = TRUE;
+    }
+  }
+
+  if (C) {
+    if (success) {
+      C->data = (void *) g_strdup (filename);
+      if (L->pinned) {
+        C->cache_key = L->cache_key;
+        L->cache_key = NULL;
+      }
+    } else {
+      g_warn_if_reached();
+      C->error = TRUE;
+      C->error_msg = g_strdup (_("loading document or picture failed"));
+    }
+    tgp_trace_done (C, tgp_trace_media);
+    -- C->pending;
+
+  } else if (success) {
+    // the message was already displayed with a placeholder, only display the content
+    struct tgp_msg_loading *D = tgp_msg_loading_init (L->msg);
+    D->data = (void *) g_strdup (filename);
+    D->media_only = TRUE;
+    tgp_msg_display (TLS, D);
+    g_free (D->data);
+    tgp_msg_loading_free (D);
+
   } else {
-    g_warn_if_reached();
-    C->error = TRUE;
-    C->error_msg = g_strdup (_("loading document or picture failed"));
+    warning ("loading deferred document or picture failed");
   }
-  
-  -- C->pending;
+  g_free (cached);
+  tgp_media_load_free (L);
+
+  tgp_msg_media_schedule (TLS);
   tgp_msg_process_in_ready (TLS);
 }
 
+static gboolean tgp_msg_media_hits_cb (gpointer data) {
+  connection_data *conn = data;
+  conn->hits_timer = 0;
+
+  struct tgp_media_load *L;
+  while ((L = g_queue_pop_head (conn->media_hits))) {
+    char *path = L->cached;
+    L->cached = NULL;
+    tgp_msg_on_loaded_document (conn->TLS, L, TRUE, path);
+    g_free (path);
+  }
+  return FALSE;
+}
+
+static void tgp_msg_media_start (struct tgl_state *TLS, struct tgp_media_load *L) {
+  connection_data *conn = TLS->ev_base;
+  struct tgl_message *M = L->msg;
+  ++ conn->media_loading;
+
+  // cached content is passed on from a timer, so that it never completes before the message
+  // finished registering all of its dependencies
+  if (conn->media_cache && (L->cache_key = tgp_cache_key (M))) {
+    L->cached = tgp_cache_lookup (L->cache_key);
+    if (L->cached) {
+      debug ("content of message server_id=%lld found in media cache", M->server_id);
+      L->pinned = TRUE;
+      g_queue_push_tail (conn->media_hits, L);
+      if (! conn->hits_timer) {
+        conn->hits_timer = purple_timeout_add (0, tgp_msg_media_hits_cb, conn);
+      }
+      return;
+    }
+  }
+
+  switch (M->media.type) {
+    case tgl_message_media_photo:
+      tgl_do_load_photo (TLS, M->media.photo, tgp_msg_on_loaded_document, L);
+      break;
+
+    case tgl_message_media_document:
+    case tgl_message_media_video:
+    case tgl_message_media_audio:
+      if (M->media.document->flags & (TGLDF_STICKER | TGLDF_IMAGE)) {
+        tgl_do_load_document (TLS, M->media.document, tgp_msg_on_loaded_document, L);
+      } else if (M->media.document->flags & TGLDF_AUDIO) {
+        tgl_do_load_audio (TLS, M->media.document, tgp_msg_on_loaded_document, L);
+      } else if (M->media.document->flags & TGLDF_VIDEO) {
+        tgl_do_load_video (TLS, M->media.document, tgp_msg_on_loaded_document, L);
+      } else {
+        tgl_do_load_document (TLS, M->media.document, tgp_msg_on_loaded_document, L);
+      }
+      break;
+
+    case tgl_message_media_document_encr:
+      tgl_do_load_encr_document (TLS, M->media.encr_document, tgp_msg_on_loaded_document, L);
+      break;
+
+    default:
+      g_warn_if_reached();
+      tgp_msg_on_loaded_document (TLS, L, FALSE, NULL);
+      break;
+  }
+}
+
+static void tgp_msg_media_schedule (struct tgl_state *TLS) {
+  connection_data *conn = TLS->ev_base;
+
+  struct tgp_media_load *L;
+  while (conn->media_loading < tgp_msg_media_concurrency (TLS) && (L = tgp_prio_queue_pop (conn->media_queue))) {
+    tgp_msg_media_start (TLS, L);
+  }
+}
+
+static void tgp_msg_media_load (struct tgl_state *TLS, struct tgp_msg_loading *C) {
+  connection_data *conn = TLS->ev_base;
+
+  struct tgp_media_load *L = g_new0 (struct tgp_media_load, 1);
+  L->msg = C->msg;
+  L->peer = tgp_msg_conv_peer (TLS, C->msg);
+
+  if (conn->media_loading < tgp_msg_media_concurrency (TLS)) {
+    L->C = C;
+    ++ C->pending;
+    tgp_msg_media_start (TLS, L);
+  } else {
+    debug ("deferring content of message server_id=%lld, %d loads queued", C->msg->server_id,
+        tgp_prio_queue_length (conn->media_queue));
+    C->media_deferred = TRUE;
+    tgp_prio_queue_push (conn->media_queue, L->peer,
+        p2tgl_find_conversation_with_account (TLS, L->peer) != NULL, C->msg->date, L);
+  }
+}
+
+void tgp_msg_media_cancel (struct tgl_state *TLS, tgl_peer_id_t peer) {
+  debug ("cancelling queued content of peer %d", tgl_get_peer_id (peer));
+  tgp_prio_queue_remove (tls_get_data (TLS)->media_queue, peer, g_free);
+}
+
+void tgp_msg_media_conv_opened (struct tgl_state *TLS, tgl_peer_id_t peer) {
+  tgp_prio_queue_set_open (tls_get_data (TLS)->media_queue, peer, TRUE);
+}
+
 static void tgp_msg_on_loaded_chat_full (struct tgl_state *TLS, void *extra, int success, struct tgl_chat *chat) {
   debug ("tgp_msg_on_loaded_chat_full()");
 
@@ -952,6 +1187,7 @@ static void tgp_msg_on_loaded_chat_full (struct tgl_state *TLS, void *extra, int
   }
 
   struct tgp_msg_loading *C = extra;
+  tgp_trace_done (C, tgp_trace_chat);
   -- C->pending;
   
   tgp_msg_process_in_ready (TLS);
@@ -960,20 +1196,132 @@ static void tgp_msg_on_loaded_chat_full (struct tgl_state *TLS, void *extra, int
 static void tgp_msg_on_loaded_channel_history (struct tgl_state *TLS, void *extra, int success, tgl_peer_t *P) {
 
   struct tgp_msg_loading *C = extra;
+  tgp_trace_done (C, tgp_trace_channel);
   -- C->pending;
 
   tgp_msg_process_in_ready (TLS);
 }
 
-//A callback for when tgp_do_load_message finishes preloading a requested message
+/*
+ Replies need the quoted message to be available before they can be displayed. To avoid one round-trip per reply
+ when catching up on busy groups, the results of all look-ups are kept in the bounded LRU *msg_cache* that is keyed
+ by the permanent message id and also remembers all recently received messages. Look-ups that miss the cache are
+ collected for the current receive batch and each distinct message is only requested once, no matter how many
+ replies are waiting for it. Failed look-ups are not cached, so that the message is requested again by the next
+ reply that quotes it.
+*/
+
+static void tgp_msg_cache_trim (connection_data *conn) {
+  GList *link = g_queue_peek_tail_link (conn->msg_cache_lru);
+  while (link && g_queue_get_length (conn->msg_cache_lru) > TGP_MSG_CACHE_SIZE) {
+    GList *prev = link->prev;
+    struct tgp_msg_cache_entry *E = link->data;
+
+    // entries that still have messages waiting for them must not be evicted
+    if (E->state != tgp_msg_cache_loading) {
+      g_queue_delete_link (conn->msg_cache_lru, link);
+      g_hash_table_remove (conn->msg_cache, &E->id);
+    }
+    link = prev;
+  }
+}
+
+static struct tgp_msg_cache_entry *tgp_msg_cache_get (connection_data *conn, tgl_message_id_t *id) {
+  struct tgp_msg_cache_entry *E = g_hash_table_lookup (conn->msg_cache, id);
+
+  if (E) {
+    g_queue_unlink (conn->msg_cache_lru, E->lru_link);
+    g_queue_push_head_link (conn->msg_cache_lru, E->lru_link);
+  }
+  return E;
+}
+
+static struct tgp_msg_cache_entry *tgp_msg_cache_add (connection_data *conn, tgl_message_id_t *id,
+    enum tgp_msg_cache_state state) {
+  struct tgp_msg_cache_entry *E = g_new0 (struct tgp_msg_cache_entry, 1);
+  E->id = *id;
+  E->state = state;
+
+  g_queue_push_head (conn->msg_cache_lru, E);
+  E->lru_link = g_queue_peek_head_link (conn->msg_cache_lru);
+  g_hash_table_replace (conn->msg_cache, &E->id, E);
+
+  tgp_msg_cache_trim (conn);
+  return E;
+}
+
+static void tgp_msg_cache_seen (connection_data *conn, struct tgl_message *M) {
+  if (! tgp_msg_cache_get (conn, &M->permanent_id)) {
+    tgp_msg_cache_add (conn, &M->permanent_id, tgp_msg_cache_available);
+  }
+}
+
+//A callback for when tgl_do_get_message finishes preloading a requested message
 static void tgp_msg_on_loaded_message_for_cache(struct tgl_state *TLS, void *extra, int success, struct tgl_message *M) {
-  struct tgp_msg_loading *C = extra;
-  -- C->pending;
-  //Do nothing: The message is cached automatically by the underlying library
-  //and we don't want to pass it to tgp_msg_recv() for display
+  struct tgp_msg_cache_entry *E = extra;
+
+  //The message is cached automatically by the underlying library and we don't want to pass it
+  //to tgp_msg_recv() for display, only release all messages that were waiting for it
+  GList *waiting = E->waiting;
+  E->waiting = NULL;
+
+  if (success && M) {
+    E->state = tgp_msg_cache_available;
+  } else {
+    connection_data *conn = TLS->ev_base;
+    g_queue_delete_link (conn->msg_cache_lru, E->lru_link);
+    g_hash_table_remove (conn->msg_cache, &E->id);
+  }
+
+  GList *W;
+  for (W = waiting; W != NULL; W = g_list_next (W)) {
+    struct tgp_msg_loading *C = W->data;
+    tgp_trace_done (C, tgp_trace_reply);
+    -- C->pending;
+  }
+  g_list_free (waiting);
+
+  tgp_msg_cache_trim (TLS->ev_base);
   tgp_msg_process_in_ready (TLS);
 }
 
+static gboolean tgp_msg_reply_fetch_cb (gpointer data) {
+  connection_data *conn = data;
+  conn->reply_timer = 0;
+
+  debug ("fetching %d quoted messages", g_queue_get_length (conn->pending_replies));
+  struct tgp_msg_cache_entry *E;
+  while ((E = g_queue_pop_head (conn->pending_replies))) {
+    tgl_do_get_message (conn->TLS, &E->id, tgp_msg_on_loaded_message_for_cache, E);
+  }
+  return FALSE;
+}
+
+static void tgp_msg_reply_load (struct tgl_state *TLS, struct tgp_msg_loading *C) {
+  connection_data *conn = TLS->ev_base;
+
+  tgl_message_id_t msg_id = C->msg->permanent_id;
+  msg_id.id = C->msg->reply_id;
+
+  struct tgp_msg_cache_entry *E = tgp_msg_cache_get (conn, &msg_id);
+  if (! E) {
+    if (tgl_message_get (TLS, &msg_id)) {
+      tgp_msg_cache_add (conn, &msg_id, tgp_msg_cache_available);
+      return;
+    }
+    E = tgp_msg_cache_add (conn, &msg_id, tgp_msg_cache_loading);
+    g_queue_push_tail (conn->pending_replies, E);
+    if (! conn->reply_timer) {
+      conn->reply_timer = purple_timeout_add (0, tgp_msg_reply_fetch_cb, conn);
+    }
+  }
+
+  if (E->state == tgp_msg_cache_loading) {
+    ++ C->pending;
+    E->waiting = g_list_prepend (E->waiting, C);
+  }
+}
+
 /*
 static void tgp_msg_on_loaded_user_full (struct tgl_state *TLS, void *extra, int success, struct tgl_user *U) {
   debug ("tgp_msg_on_loaded_user_full()");
@@ -984,6 +1332,41 @@ static void tgp_msg_on_loaded_user_full (struct tgl_state *TLS, void *extra, int
 }
 */
 
+/*
+ Messages fetched from the history of a channel need to be inserted into *new_messages* before all newer messages
+ of the same channel that are already waiting. To find that position without scanning the whole queue, the
+ queued messages of each channel are also kept in a sequence that is ordered by their server id.
+*/
+static gint tgp_msg_queue_cmp (gconstpointer a, gconstpointer b, gpointer data) {
+  long long x = ((const struct tgp_msg_loading *) a)->msg->server_id;
+  long long y = ((const struct tgp_msg_loading *) b)->msg->server_id;
+  return (x > y) - (x < y);
+}
+
+static void tgp_msg_queue_channel (struct tgl_state *TLS, struct tgp_msg_loading *C, tgl_peer_id_t channel,
+    int backfill) {
+  connection_data *conn = TLS->ev_base;
+
+  gpointer key = GINT_TO_POINTER(tgl_get_peer_id (channel));
+  GSequence *queued = g_hash_table_lookup (conn->channel_queues, key);
+  if (! queued) {
+    queued = g_sequence_new (NULL);
+    g_hash_table_insert (conn->channel_queues, key, queued);
+  }
+
+  GSequenceIter *next = g_sequence_search (queued, C, tgp_msg_queue_cmp, NULL);
+  if (backfill && ! g_sequence_iter_is_end (next)) {
+    GList *link = ((struct tgp_msg_loading *) g_sequence_get (next))->link;
+    debug ("inserting before server_id=%lld", ((struct tgp_msg_loading *) link->data)->msg->server_id);
+    g_queue_insert_before (conn->new_messages, link, C);
+    C->link = link->prev;
+  } else {
+    g_queue_push_tail (conn->new_messages, C);
+    C->link = g_queue_peek_tail_link (conn->new_messages);
+  }
+  C->channel_iter = g_sequence_insert_before (next, C);
+}
+
 /*
  Libpurple message history is immutable and cannot be changed after printing a message.
  TGP currently keeps the first-in first-out queue *new_messages* to ensure that
@@ -991,8 +1374,8 @@ static void tgp_msg_on_loaded_user_full (struct tgl_state *TLS, void *extra, int
  additional info (like attached pictures) before this can be done, the queue will hold
  all newer messages until the old message was completely loaded.
 */
-void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before) {
-  debug ("tgp_msg_recv before=%p server_id=%lld", before, M->server_id);
+void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, int backfill) {
+  debug ("tgp_msg_recv backfill=%d server_id=%lld", backfill, M->server_id);
   
   if (M->flags & (TGLMF_EMPTY | TGLMF_DELETED)) {
     return;
@@ -1008,6 +1391,8 @@ void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before)
   }
   
   struct tgp_msg_loading *C = tgp_msg_loading_init (M);
+  tgp_trace_recv (TLS, C);
+  tgp_msg_cache_seen (TLS->ev_base, M);
   
   /*
    For non-channels telegram ensures that tgp receives the messages in the correct order, but in channels
@@ -1015,12 +1400,14 @@ void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before)
    queue may not be processed until all historic messages have been fetched and the messages have been
    inserted into the correct position of the queue
    */
-  if (tgl_get_peer_type (C->msg->from_id) == TGL_PEER_CHANNEL
-      || tgl_get_peer_type (C->msg->to_id) == TGL_PEER_CHANNEL) {
-    tgl_peer_id_t id = tgl_get_peer_type (C->msg->from_id) == TGL_PEER_CHANNEL ?
-      C->msg->from_id : C->msg->to_id;
+  int is_channel = tgl_get_peer_type (C->msg->from_id) == TGL_PEER_CHANNEL
+      || tgl_get_peer_type (C->msg->to_id) == TGL_PEER_CHANNEL;
+  tgl_peer_id_t channel = tgl_get_peer_type (C->msg->from_id) == TGL_PEER_CHANNEL ? C->msg->from_id : C->msg->to_id;
+  if (is_channel) {
+    tgl_peer_id_t id = channel;
     
-    if (! tgp_channel_loaded (TLS, id)) {
+    // messages from the history must not wait for the channel to finish loading, or the whole gap would be buffered
+    if (! tgp_channel_loaded (TLS, id) && ! backfill) {
       ++ C->pending;
       
       tgp_channel_load (TLS, tgl_peer_get (TLS, id), tgp_msg_on_loaded_channel_history, C);
@@ -1045,8 +1432,7 @@ void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before)
           // include the "bad photo" check from telegram-cli interface.c:3287 to avoid crashes
           // when fetching history. TODO: find out the reason for this behavior
           if (M->media.photo) {
-            ++ C->pending;
-            tgl_do_load_photo (TLS, M->media.photo, tgp_msg_on_loaded_document, C);
+            tgp_msg_media_load (TLS, C);
           }
           break;
         }
@@ -1057,8 +1443,7 @@ void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before)
         case tgl_message_media_video:
         case tgl_message_media_audio:
           if (M->media.document->flags & (TGLDF_STICKER | TGLDF_IMAGE)) {
-            ++ C->pending;
-            tgl_do_load_document (TLS, M->media.document, tgp_msg_on_loaded_document, C);
+            tgp_msg_media_load (TLS, C);
             
           } else {
 
@@ -1066,17 +1451,7 @@ void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before)
 #ifndef __ADIUM_
 
             if (M->media.document->size <= tls_get_ft_threshold (TLS) || tls_get_ft_autoload (TLS)) {
-              ++ C->pending;
-
-              if (M->media.document->flags & TGLDF_AUDIO) {
-                tgl_do_load_audio (TLS, M->media.document, tgp_msg_on_loaded_document, C);
-
-              } else if (M->media.document->flags & TGLDF_VIDEO) {
-                tgl_do_load_video (TLS, M->media.document, tgp_msg_on_loaded_document, C);
-
-              } else {
-                tgl_do_load_document (TLS, M->media.document, tgp_msg_on_loaded_document, C);
-              }
+              tgp_msg_media_load (TLS, C);
             }
 
 #endif
@@ -1085,8 +1460,7 @@ void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before)
 
         case tgl_message_media_document_encr:
           if (M->media.encr_document->flags & TGLDF_STICKER || M->media.encr_document->flags & TGLDF_IMAGE) {
-            ++ C->pending;
-            tgl_do_load_encr_document (TLS, M->media.encr_document, tgp_msg_on_loaded_document, C);
+            tgp_msg_media_load (TLS, C);
           }
           break;
 
@@ -1127,17 +1501,11 @@ void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before)
   
   //Reply processing requires quoted messages to also be available
   if (M->reply_id) {
-    ++ C->pending;
-    tgl_message_id_t msg_id = M->permanent_id;
-    msg_id.id = M->reply_id;
-    tgl_do_get_message(TLS, &msg_id, tgp_msg_on_loaded_message_for_cache, C);
+    tgp_msg_reply_load (TLS, C);
   }
 
-  GList *b = g_queue_find (tls_get_data (TLS)->new_messages, before);
-  if (b) {
-    struct tgp_msg_loading *M = before->data;
-    debug ("inserting before server_id=%lld", M->msg->server_id);
-    g_queue_insert_before (tls_get_data (TLS)->new_messages, b, C);
+  if (is_channel) {
+    tgp_msg_queue_channel (TLS, C, channel, backfill);
   } else {
     g_queue_push_tail (tls_get_data (TLS)->new_messages, C);
   }
@@ -25,9 +25,11 @@
  * Process a message and display it
  *
  * Loads embedded ressources like pictures or document thumbnails and ensures that 
- * that all messages are still displayed in the original incoming order.
+ * that all messages are still displayed in the original incoming order. Channel messages
+ * fetched from the history are marked as backfill and displayed before all newer messages
+ * of the same channel.
  */
-void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, GList *before);
+void tgp_msg_recv (struct tgl_state *TLS, struct tgl_message *M, int backfill);
 
 /**
  * Process a message and send it to the peer
@@ -43,4 +45,15 @@ int tgp_msg_send (struct tgl_state *TLS, const char *msg, tgl_peer_id_t to);
  */
 void tgp_msg_special_out (struct tgl_state *TLS, const char *msg, tgl_peer_id_t to_id, int flags);
 
+/**
+ * Drop all queued, not yet started content loads for messages in the conversation with a peer
+ */
+void tgp_msg_media_cancel (struct tgl_state *TLS, tgl_peer_id_t peer);
+void tgp_msg_media_conv_opened (struct tgl_state *TLS, tgl_peer_id_t peer);
+
+/**
+ * Return the date of the oldest message that is still relevant for display, or 0 to display all messages
+ */
+time_t tgp_msg_oldest_relevant_ts (struct tgl_state *TLS);
+
 #endif
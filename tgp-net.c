@@ -53,6 +53,7 @@
 static void fail_connection (struct connection *c);
 static void restart_connection (struct connection *c);
 static void start_ping_timer (struct connection *c);
+static void conn_try_read (gpointer arg, gint source, PurpleInputCondition cond);
 static void conn_try_write (gpointer arg, gint source, PurpleInputCondition cond);
 static void try_read (struct connection *c);
 static void try_write (struct connection *c);
@@ -96,6 +97,126 @@ static void start_fail_timer (struct connection *c) {
   c->fail_ev = purple_timeout_add_seconds (CONNECT_TIMEOUT, fail_alarm, c);
 }
 
+/*
+  The traffic of an account can be limited per direction with the account options TGP_KEY_UPLOAD_LIMIT and
+  TGP_KEY_DOWNLOAD_LIMIT, and the traffic of all accounts together with the preferences TGP_PREF_UPLOAD_LIMIT
+  and TGP_PREF_DOWNLOAD_LIMIT. Every limit is a token bucket that holds up to one second of traffic. When a
+  bucket is empty, the connection stops watching its socket until enough tokens were refilled. Sending is
+  only held back while libtgl uploads a file and more than TGP_NET_BULK_BYTES are queued. Every write of at
+  most TGP_NET_BULK_BYTES is a request that is not a file part: the queue is always flushed up to its end,
+  even if that overdraws the buckets, so chat requests queued behind a file part are never delayed by the
+  limit, but the bytes they use are still counted. Incoming data cannot
+  be told apart before it was read, so reading is never held back on connections to the working DC, which
+  deliver messages and updates, and only while libtgl downloads files on connections to other DCs, which are
+  only opened to load files. Files that are stored on the working DC are therefore not limited, but their
+  bytes are counted against the limit of the other downloads.
+*/
+static struct tgp_net_bucket global_buckets[tgp_net_directions];
+
+static int tgp_net_limit (struct tgl_state *TLS, enum tgp_net_direction dir, int global) {
+  int kb;
+  if (global) {
+    kb = purple_prefs_get_int (dir == tgp_net_up ? TGP_PREF_UPLOAD_LIMIT : TGP_PREF_DOWNLOAD_LIMIT);
+  } else {
+    kb = purple_account_get_int (tls_get_pa (TLS), dir == tgp_net_up ? TGP_KEY_UPLOAD_LIMIT : TGP_KEY_DOWNLOAD_LIMIT,
+        0);
+  }
+  return kb > 0 ? kb * 1024 : 0;
+}
+
+static void tgp_net_bucket_refill (struct tgp_net_bucket *B, int rate, double now) {
+  if (rate != B->rate) {
+    B->rate = rate;
+    B->tokens = rate;
+  } else if (rate > 0) {
+    B->tokens = MIN(B->tokens + (now - B->stamp) * rate, rate);
+  }
+  B->stamp = now;
+}
+
+// Return how many bytes may pass now or -1 when no limit applies. When nothing may pass, wait is set
+// to the number of milliseconds until the buckets contain enough tokens again.
+static int tgp_net_allowance (struct connection *c, enum tgp_net_direction dir, int *wait) {
+  struct tgp_net_bucket *buckets[2] = { &tls_get_data (c->TLS)->buckets[dir], &global_buckets[dir] };
+  double now = tglt_get_double_time ();
+  int allow = -1;
+  int i;
+
+  *wait = 0;
+  for (i = 0; i < 2; i ++) {
+    struct tgp_net_bucket *B = buckets[i];
+    tgp_net_bucket_refill (B, tgp_net_limit (c->TLS, dir, i), now);
+    if (B->rate <= 0) {
+      continue;
+    }
+    if (B->tokens < 1) {
+      *wait = MAX(*wait, (int) ((1 - B->tokens) * 1000 / B->rate) + 1);
+      allow = 0;
+    } else if (allow != 0 && (allow < 0 || B->tokens < allow)) {
+      allow = (int) B->tokens;
+    }
+  }
+  return allow;
+}
+
+static void tgp_net_consume (struct connection *c, enum tgp_net_direction dir, int bytes) {
+  struct tgp_net_bucket *B = &tls_get_data (c->TLS)->buckets[dir];
+  double now = tglt_get_double_time ();
+
+  B->tokens -= bytes;
+  global_buckets[dir].tokens -= bytes;
+
+  B->total += bytes;
+  B->window_bytes += bytes;
+  if (now - B->window_start >= 1) {
+    B->throughput = B->window_start > 0 ? B->window_bytes / (now - B->window_start) : 0;
+    B->window_start = now;
+    B->window_bytes = 0;
+  }
+}
+
+static int tgp_net_resume_read (gpointer arg) {
+  struct connection *c = arg;
+  c->read_shape_ev = -1;
+  if (c->read_ev < 0 && c->fd >= 0) {
+    c->read_ev = purple_input_add (c->fd, PURPLE_INPUT_READ, conn_try_read, c);
+  }
+  return FALSE;
+}
+
+static int tgp_net_resume_write (gpointer arg) {
+  struct connection *c = arg;
+  c->write_shape_ev = -1;
+  if (c->write_ev < 0 && c->out_bytes && c->fd >= 0) {
+    c->write_ev = purple_input_add (c->fd, PURPLE_INPUT_WRITE, conn_try_write, c);
+  }
+  return FALSE;
+}
+
+static void tgp_net_pause (struct connection *c, enum tgp_net_direction dir, int wait) {
+  int *ev = dir == tgp_net_up ? &c->write_ev : &c->read_ev;
+  int *shape_ev = dir == tgp_net_up ? &c->write_shape_ev : &c->read_shape_ev;
+
+  if (*ev >= 0) {
+    purple_input_remove (*ev);
+    *ev = -1;
+  }
+  if (*shape_ev < 0) {
+    *shape_ev = purple_timeout_add (wait, dir == tgp_net_up ? tgp_net_resume_write : tgp_net_resume_read, c);
+  }
+}
+
+static void tgp_net_unpause (struct connection *c) {
+  if (c->read_shape_ev >= 0) {
+    purple_timeout_remove (c->read_shape_ev);
+    c->read_shape_ev = -1;
+  }
+  if (c->write_shape_ev >= 0) {
+    purple_timeout_remove (c->write_shape_ev);
+    c->write_shape_ev = -1;
+  }
+}
+
 static struct connection_buffer *new_connection_buffer (int size) {
   struct connection_buffer *b = malloc (sizeof (*b));
   memset (b, 0, sizeof (*b));
@@ -116,10 +237,20 @@ int tgln_write_out (struct connection *c, const void *_data, int len) {
   if (!len) { return 0; }
   assert (len > 0);
   int x = 0;
-  if (!c->out_bytes) {
+  if (!c->out_bytes && c->write_shape_ev == -1) {
     assert (c->write_ev == -1);
     c->write_ev = purple_input_add (c->fd, PURPLE_INPUT_WRITE, conn_try_write, c);
   }
+  if (len <= TGP_NET_BULK_BYTES) {
+    c->urgent_bytes = c->out_bytes + len;
+    if (c->write_shape_ev >= 0) {
+      purple_timeout_remove (c->write_shape_ev);
+      c->write_shape_ev = -1;
+      if (c->write_ev < 0) {
+        c->write_ev = purple_input_add (c->fd, PURPLE_INPUT_WRITE, conn_try_write, c);
+      }
+    }
+  }
   if (!c->out_head) {
     struct connection_buffer *b = new_connection_buffer (1 << 20);
     c->out_head = c->out_tail = b;
@@ -235,7 +366,7 @@ static void conn_try_write (gpointer arg, gint source, PurpleInputCondition cond
     c->methods->ready (TLS, c);
   }
   try_write (c);
-  if (!c->out_bytes) {
+  if (!c->out_bytes && c->write_ev >= 0) {
     purple_input_remove (c->write_ev);
     c->write_ev = -1;
   }
@@ -302,6 +433,8 @@ struct connection *tgln_create_connection (struct tgl_state *TLS, const char *ho
   c->fail_ev = -1;
   c->write_ev = -1;
   c->read_ev = -1;
+  c->read_shape_ev = -1;
+  c->write_shape_ev = -1;
 
   c->dc = dc;
   c->session = session;
@@ -339,6 +472,7 @@ static void fail_connection (struct connection *c) {
     purple_input_remove (c->read_ev);
     c->read_ev = -1;
   }
+  tgp_net_unpause (c);
   
   rotate_port (c);
 
@@ -357,6 +491,7 @@ static void fail_connection (struct connection *c) {
   c->out_head = c->out_tail = c->in_head = c->in_tail = 0;
   c->state = conn_failed;
   c->out_bytes = c->in_bytes = 0;
+  c->urgent_bytes = 0;
   
   c->prpl_data = NULL;
 
@@ -367,9 +502,28 @@ static void fail_connection (struct connection *c) {
 
 static void try_write (struct connection *c) {
   // debug ("try write: fd = %d\n", c->fd);
+  int wait = 0;
+  int allow = -1;
+  if (c->TLS->cur_uploading_bytes > 0 && c->out_bytes > TGP_NET_BULK_BYTES) {
+    allow = tgp_net_allowance (c, tgp_net_up, &wait);
+    if (allow >= 0 && allow < c->urgent_bytes) {
+      allow = c->urgent_bytes;
+    }
+  }
+  if (allow == 0) {
+    tgp_net_pause (c, tgp_net_up, wait);
+    return;
+  }
   int x = 0;
   while (c->out_head) {
-    int r = send (c->fd, (const char *)c->out_head->rptr, c->out_head->wptr - c->out_head->rptr, 0);
+    int len = c->out_head->wptr - c->out_head->rptr;
+    if (allow >= 0 && len > allow - x) {
+      len = allow - x;
+      if (len <= 0) {
+        break;
+      }
+    }
+    int r = send (c->fd, (const char *)c->out_head->rptr, len, 0);
     if (r >= 0) {
       x += r;
       c->out_head->rptr += r;
@@ -394,6 +548,8 @@ static void try_write (struct connection *c) {
   }
   // debug ("Sent %d bytes to %d\n", x, c->fd);
   c->out_bytes -= x;
+  c->urgent_bytes = MAX(c->urgent_bytes - x, 0);
+  tgp_net_consume (c, tgp_net_up, x);
 }
 
 static void try_rpc_read (struct connection *c) {
@@ -443,9 +599,23 @@ static void try_read (struct connection *c) {
     struct timeval tv = {5, 0};
     event_add (c->read_ev, &tv);
   #endif
+  int wait = 0;
+  int bulk = c->TLS->dc_working_num != c->dc->id && c->TLS->cur_downloading_bytes > 0;
+  int allow = bulk ? tgp_net_allowance (c, tgp_net_down, &wait) : -1;
+  if (allow == 0) {
+    tgp_net_pause (c, tgp_net_down, wait);
+    return;
+  }
   int x = 0;
   while (1) {
-    int r = recv (c->fd, (char *)c->in_tail->wptr, c->in_tail->end - c->in_tail->wptr, 0);
+    int len = c->in_tail->end - c->in_tail->wptr;
+    if (allow >= 0 && len > allow - x) {
+      len = allow - x;
+      if (len <= 0) {
+        break;
+      }
+    }
+    int r = recv (c->fd, (char *)c->in_tail->wptr, len, 0);
     if (r > 0) {
       c->last_receive_time = tglt_get_double_time ();
       stop_ping_timer (c);
@@ -472,7 +642,9 @@ static void try_read (struct connection *c) {
   }
   // debug ("Received %d bytes from %d\n", x, c->fd);
   c->in_bytes += x;
+  tgp_net_consume (c, tgp_net_down, x);
   if (x) {
+    tgp_trace_read (c->TLS);
     try_rpc_read (c);
   }
 }
@@ -519,6 +691,7 @@ static void tgln_free (struct connection *c) {
   if (c->write_ev >= 0) { 
     purple_input_remove (c->write_ev);
   }
+  tgp_net_unpause (c);
 
   if (c->fd >= 0) { close (c->fd); }
   c->fd = -1;
@@ -49,6 +49,7 @@ struct connection {
   struct connection_buffer *out_tail;
   int in_bytes;
   int out_bytes;
+  int urgent_bytes;
   int packet_num;
   int out_packet_num;
   int last_connect_time;
@@ -62,6 +63,8 @@ struct connection {
   int fail_ev;
   int read_ev;
   int write_ev;
+  int read_shape_ev;
+  int write_shape_ev;
   double last_receive_time;
   void *prpl_data;
 };
@@ -234,6 +234,31 @@ void request_cur_and_new_password (struct tgl_state *TLS,
       request_values_data_init (TLS, callback, arg, 0));
 }
 
+static void request_bandwidth_limits_ok (struct request_values_data *data, PurpleRequestFields* fields) {
+  purple_prefs_set_int (TGP_PREF_UPLOAD_LIMIT, MAX(purple_request_fields_get_integer (fields, "upload"), 0));
+  purple_prefs_set_int (TGP_PREF_DOWNLOAD_LIMIT, MAX(purple_request_fields_get_integer (fields, "download"), 0));
+  free (data);
+}
+
+void request_bandwidth_limits (struct tgl_state *TLS) {
+  PurpleRequestFields* fields = purple_request_fields_new ();
+  PurpleRequestFieldGroup* group = purple_request_field_group_new (
+      _("Limit the traffic of all Telegram accounts together (kB/s, 0 for unlimited)"));
+
+  PurpleRequestField *field = purple_request_field_int_new ("upload", _("Uploads"),
+      purple_prefs_get_int (TGP_PREF_UPLOAD_LIMIT));
+  purple_request_field_group_add_field (group, field);
+
+  field = purple_request_field_int_new ("download", _("Downloads"), purple_prefs_get_int (TGP_PREF_DOWNLOAD_LIMIT));
+  purple_request_field_group_add_field (group, field);
+
+  purple_request_fields_add_group (fields, group);
+  purple_request_fields (tls_get_conn (TLS), _("Bandwidth"), _("Bandwidth of all accounts"), NULL, fields,
+      _("OK"), G_CALLBACK(request_bandwidth_limits_ok),
+      _("Cancel"), G_CALLBACK(request_canceled), tls_get_pa (TLS), NULL, NULL,
+      request_values_data_init (TLS, NULL, NULL, 0));
+}
+
 static void request_new_password_ok (struct request_values_data *data, PurpleRequestFields* fields) {
   const char *names[2] = {
       purple_request_fields_get_string (fields, "new1"),
@@ -42,6 +42,7 @@ void request_value (struct tgl_state *TLS, enum tgl_value_type type, const char
     void (*callback) (struct tgl_state *TLS, const char *string[], void *arg), void *arg);
 void request_accept_secret_chat (struct tgl_state *TLS, struct tgl_secret_chat *U);
 void request_create_chat (struct tgl_state *TLS, const char *subject);
+void request_bandwidth_limits (struct tgl_state *TLS);
 
 void tgprpl_request_delete_contact (PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup *group);
 
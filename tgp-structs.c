@@ -20,42 +20,108 @@
 
 #include "telegram-base.h"
 
+/*
+ Read recipes are collected per peer, only keeping the highest message id, and sent once every
+ TGP_PENDING_READS_DELAY milliseconds. This avoids sending one mark-read request after almost every
+ message while catching up on a busy conversation.
+*/
+static gint64 pending_reads_key (tgl_peer_id_t id) {
+  // users, chats and channels may share the same numeric id
+  return ((gint64) tgl_get_peer_type (id) << 32) | (guint32) tgl_get_peer_id (id);
+}
+
+static void pending_reads_mark_read (struct tgl_state *TLS, struct tgp_pending_read *R) {
+  info ("tgl_do_mark_read (%d) up to server_id=%lld", tgl_get_peer_id (R->id), R->max_id);
+  tgl_do_mark_read (TLS, R->id, tgp_notify_on_error_gw, NULL);
+
+  // messages of secret chats have no increasing server ids, so there is nothing to remember
+  if (tgl_get_peer_type (R->id) != TGL_PEER_ENCR_CHAT) {
+    struct tgp_pending_read *marked = g_memdup (R, sizeof (struct tgp_pending_read));
+    g_hash_table_replace (tls_get_data (TLS)->read_marks, &marked->key, marked);
+  }
+}
+
 static void tgl_do_mark_read_gw (gpointer key, gpointer value, gpointer data) {
-  tgl_peer_id_t to = * (tgl_peer_id_t *)value;
-  info ("tgl_do_mark_read (%d)", tgl_get_peer_id (to));
-  tgl_do_mark_read ((struct tgl_state *) data, to, tgp_notify_on_error_gw, NULL);
+  pending_reads_mark_read ((struct tgl_state *) data, value);
 }
 
-void pending_reads_send_all (struct tgl_state *TLS) {
+static int pending_reads_enabled (struct tgl_state *TLS) {
   if (! purple_account_get_bool (tls_get_pa (TLS), TGP_KEY_SEND_READ_NOTIFICATIONS,
       TGP_DEFAULT_SEND_READ_NOTIFICATIONS)) {
     debug ("automatic read recipes disabled, not sending recipes");
-    return;
+    return FALSE;
   }
   if (! p2tgl_status_is_present (purple_account_get_active_status (tls_get_pa (TLS)))) {
     debug ("user is not present, not sending recipes");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+void pending_reads_send_all (struct tgl_state *TLS) {
+  connection_data *conn = tls_get_data (TLS);
+  if (conn->reads_timer) {
+    purple_timeout_remove (conn->reads_timer);
+    conn->reads_timer = 0;
+  }
+  if (! pending_reads_enabled (TLS)) {
     return;
   }
   debug ("sending all pending recipes");
-  g_hash_table_foreach (tls_get_data (TLS)->pending_reads, tgl_do_mark_read_gw, TLS);
-  g_hash_table_remove_all (tls_get_data (TLS)->pending_reads);
+  g_hash_table_foreach (conn->pending_reads, tgl_do_mark_read_gw, TLS);
+  g_hash_table_remove_all (conn->pending_reads);
+}
+
+static gboolean pending_reads_send_all_cb (gpointer data) {
+  connection_data *conn = data;
+  conn->reads_timer = 0;
+  pending_reads_send_all (conn->TLS);
+  return FALSE;
+}
+
+// pending reads are kept without a timer while they cannot be sent, the next status change sends them
+void pending_reads_schedule (struct tgl_state *TLS) {
+  connection_data *conn = tls_get_data (TLS);
+  if (! conn->reads_timer && g_hash_table_size (conn->pending_reads) && pending_reads_enabled (TLS)) {
+    conn->reads_timer = purple_timeout_add (TGP_PENDING_READS_DELAY, pending_reads_send_all_cb, conn);
+  }
 }
 
 void pending_reads_send_user (struct tgl_state *TLS, tgl_peer_id_t id) {
-  if (g_hash_table_remove (tls_get_data (TLS)->pending_reads, GINT_TO_POINTER (tgl_get_peer_id (id)))) {
-    info ("tgl_do_mark_read (%d)", tgl_get_peer_id (id));
-    tgl_do_mark_read (TLS, id, tgp_notify_on_error_gw, NULL);
+  gint64 key = pending_reads_key (id);
+  struct tgp_pending_read *R = g_hash_table_lookup (tls_get_data (TLS)->pending_reads, &key);
+  if (R) {
+    pending_reads_mark_read (TLS, R);
+    g_hash_table_remove (tls_get_data (TLS)->pending_reads, &key);
   }
 }
 
 void pending_reads_add (struct tgl_state *TLS, struct tgl_message *M) {
-  tgl_peer_id_t *copy = g_new (tgl_peer_id_t, 1);
+  connection_data *conn = tls_get_data (TLS);
+  tgl_peer_id_t id;
   if (tgl_get_peer_type (M->to_id) == TGL_PEER_USER) {
-    *copy = M->from_id;
+    id = M->from_id;
   } else {
-    *copy = M->to_id;
+    id = M->to_id;
+  }
+  gint64 key = pending_reads_key (id);
+
+  // messages up to this one were already marked as read, secret chats are never recorded there
+  struct tgp_pending_read *marked = g_hash_table_lookup (conn->read_marks, &key);
+  if (marked && M->server_id <= marked->max_id) {
+    return;
+  }
+
+  struct tgp_pending_read *R = g_hash_table_lookup (conn->pending_reads, &key);
+  if (! R) {
+    R = g_new0 (struct tgp_pending_read, 1);
+    R->key = key;
+    g_hash_table_replace (conn->pending_reads, &R->key, R);
+  }
+  R->id = id;
+  if (M->server_id > R->max_id) {
+    R->max_id = M->server_id;
   }
-  g_hash_table_replace (tls_get_data (TLS)->pending_reads, GINT_TO_POINTER (tgl_get_peer_id (*copy)), copy);
 }
 
 static void used_image_free (gpointer data) {
@@ -68,6 +134,10 @@ void used_images_add (connection_data *data, gint imgid) {
 
 void tgp_msg_loading_free (gpointer data) {
   struct tgp_msg_loading *C = data;
+  if (C->cache_key) {
+    tgp_cache_unpin (C->cache_key);
+    g_free (C->cache_key);
+  }
   free (C);
 }
 
@@ -79,6 +149,41 @@ struct tgp_msg_loading *tgp_msg_loading_init (struct tgl_message *M) {
   return C;
 }
 
+void tgp_sticker_entry_free (gpointer data) {
+  struct tgp_sticker_entry *E = data;
+  purple_imgstore_unref_by_id (E->img);
+  g_free (E);
+}
+
+void tgp_media_load_free (gpointer data) {
+  struct tgp_media_load *L = data;
+  if (L->pinned && L->cache_key) {
+    tgp_cache_unpin (L->cache_key);
+  }
+  g_free (L->cache_key);
+  g_free (L->cached);
+  g_free (L);
+}
+
+static guint tgp_msg_cache_hash (gconstpointer key) {
+  const tgl_message_id_t *id = key;
+  gint64 v = ((gint64) id->peer_type << 32) | (guint32) id->peer_id;
+  return g_int64_hash (&v) ^ g_int64_hash (&id->id);
+}
+
+static gboolean tgp_msg_cache_equal (gconstpointer a, gconstpointer b) {
+  const tgl_message_id_t *x = a, *y = b;
+  return x->peer_type == y->peer_type && x->peer_id == y->peer_id && x->id == y->id;
+}
+
+void tgp_msg_cache_entry_free (gpointer data) {
+  struct tgp_msg_cache_entry *E = data;
+  if (E->waiting) {
+    g_list_free (E->waiting);
+  }
+  g_free (E);
+}
+
 struct tgp_msg_sending *tgp_msg_sending_init (struct tgl_state *TLS, char *M, tgl_peer_id_t to) {
   struct tgp_msg_sending *C = malloc (sizeof (struct tgp_msg_sending));
   C->TLS = TLS;
@@ -100,14 +205,36 @@ connection_data *connection_data_init (struct tgl_state *TLS, PurpleConnection *
   conn->TLS = TLS;
   conn->gc = gc;
   conn->pa = pa;
+  conn->history_days = purple_account_get_int (pa, TGP_KEY_HISTORY_RETRIEVAL_THRESHOLD,
+      TGP_DEFAULT_HISTORY_RETRIEVAL_THRESHOLD);
+  conn->inactive_cutoff = tgp_time_n_days_ago (purple_account_get_int (pa, TGP_KEY_INACTIVE_DAYS_OFFLINE,
+      TGP_DEFAULT_INACTIVE_DAYS_OFFLINE));
   conn->new_messages = g_queue_new ();
   conn->out_messages = g_queue_new ();
-  conn->pending_reads = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  conn->pending_reads = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, g_free);
+  conn->read_marks = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, g_free);
+  conn->msg_cache = g_hash_table_new_full (tgp_msg_cache_hash, tgp_msg_cache_equal, NULL, tgp_msg_cache_entry_free);
+  conn->msg_cache_lru = g_queue_new ();
+  conn->stickers = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, tgp_sticker_entry_free);
+  conn->stickers_lru = g_queue_new ();
+  conn->pending_replies = g_queue_new ();
+  conn->trace = g_new0 (struct tgp_trace_stats, 1);
   conn->pending_chat_info = g_hash_table_new (g_direct_hash, g_direct_equal);
   conn->pending_channels = g_hash_table_new (g_direct_hash, g_direct_equal);
-  conn->id_to_purple_name = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
-  conn->purple_name_to_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-  conn->channel_members = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (void (*) (gpointer)) g_list_free);
+  conn->channel_queues = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+      (void (*) (gpointer)) g_sequence_free);
+  conn->purple_names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  conn->id_to_purple_name = g_hash_table_new (g_direct_hash, g_direct_equal);
+  conn->purple_name_to_id = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+  conn->print_name_suffixes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  conn->channel_members = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, tgp_channel_members_free);
+  conn->buddy_nodes = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+  conn->chat_nodes = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+  conn->pending_photos = g_queue_new ();
+  conn->media_hits = g_queue_new ();
+  conn->media_queue = tgp_prio_queue_new ();
+  conn->channel_queue = tgp_prio_queue_new ();
+  conn->user_states = g_hash_table_new (g_direct_hash, g_direct_equal);
   
   return conn;
 }
@@ -116,21 +243,49 @@ void *connection_data_free (connection_data *conn) {
   if (conn->write_timer) { purple_timeout_remove (conn->write_timer); }
   if (conn->login_timer) { purple_timeout_remove (conn->login_timer); }
   if (conn->out_timer) { purple_timeout_remove (conn->out_timer); }
+  if (conn->reply_timer) { purple_timeout_remove (conn->reply_timer); }
+  if (conn->reads_timer) { purple_timeout_remove (conn->reads_timer); }
+  if (conn->photo_timer) { purple_timeout_remove (conn->photo_timer); }
+  if (conn->status_timer) { purple_timeout_remove (conn->status_timer); }
+  if (conn->hits_timer) { purple_timeout_remove (conn->hits_timer); }
+  if (conn->xfer_timer) { purple_timeout_remove (conn->xfer_timer); conn->xfer_timer = 0; }
 
   tgp_g_queue_free_full (conn->new_messages, tgp_msg_loading_free);
   tgp_g_queue_free_full (conn->out_messages, tgp_msg_sending_free);
+  tgp_g_queue_free_full (conn->pending_photos, g_free);
+  tgp_g_queue_free_full (conn->media_hits, tgp_media_load_free);
   tgp_g_list_free_full (conn->used_images, used_image_free);
+  tgp_prio_queue_free (conn->media_queue, g_free);
   tgp_g_list_free_full (conn->pending_joins, g_free);
+  tgp_prio_queue_free (conn->channel_queue, g_free);
+  g_queue_free (conn->pending_replies);
+  g_queue_free (conn->msg_cache_lru);
+  g_queue_free (conn->stickers_lru);
+  g_hash_table_destroy (conn->stickers);
+  g_hash_table_destroy (conn->msg_cache);
   g_hash_table_destroy (conn->pending_reads);
+  g_hash_table_destroy (conn->read_marks);
   g_hash_table_destroy (conn->pending_chat_info);
   g_hash_table_destroy (conn->pending_channels);
+  g_hash_table_destroy (conn->channel_queues);
   g_hash_table_destroy (conn->id_to_purple_name);
   g_hash_table_destroy (conn->purple_name_to_id);
+  g_hash_table_destroy (conn->purple_names);
+  g_hash_table_destroy (conn->print_name_suffixes);
+  g_hash_table_destroy (conn->buddy_nodes);
+  g_hash_table_destroy (conn->chat_nodes);
+  g_hash_table_destroy (conn->user_states);
   g_hash_table_destroy (conn->channel_members);
+  g_free (conn->trace);
+  if (conn->media_cache) {
+    tgp_cache_release ();
+  }
   g_free (conn->download_dir);
   g_free (conn->download_uri);
 
   tgprpl_xfer_free_all (conn);
+  g_list_free (conn->xfers);
+  g_list_free (conn->xfer_queue);
   g_free (conn->TLS->base_path);
   tgl_free_all (conn->TLS);
  
@@ -26,6 +26,56 @@
 #include <tgl.h>
 #include <glib.h>
 
+#define TGP_TRACE_BUCKETS 16
+#define TGP_TRACE_SLOWEST 10
+
+enum tgp_trace_stage {
+  tgp_trace_receive,
+  tgp_trace_media,
+  tgp_trace_chat,
+  tgp_trace_channel,
+  tgp_trace_reply,
+  tgp_trace_queue,
+  tgp_trace_total,
+  tgp_trace_stages
+};
+
+struct tgp_trace {
+  gint64 read;
+  gint64 recv;
+  gint64 done[tgp_trace_stages];
+};
+
+struct tgp_trace_sample {
+  long long server_id;
+  tgl_peer_id_t to_id;
+  gint64 duration[tgp_trace_stages];
+};
+
+struct tgp_trace_stats {
+  gint64 last_read;
+  int count;
+  int histogram[tgp_trace_stages][TGP_TRACE_BUCKETS];
+  int samples;
+  struct tgp_trace_sample slowest[TGP_TRACE_SLOWEST];
+};
+
+enum tgp_net_direction {
+  tgp_net_up,
+  tgp_net_down,
+  tgp_net_directions
+};
+
+struct tgp_net_bucket {
+  int rate;
+  double tokens;
+  double stamp;
+  gint64 total;
+  gint64 window_bytes;
+  double window_start;
+  double throughput;
+};
+
 typedef struct {
   struct tgl_state *TLS;
   char *hash;
@@ -35,28 +85,77 @@ typedef struct {
   GQueue *new_messages;
   GQueue *out_messages;
   GHashTable *pending_reads;
+  GHashTable *read_marks;
+  GHashTable *msg_cache;
+  GQueue *msg_cache_lru;
+  GHashTable *stickers;
+  GQueue *stickers_lru;
+  GQueue *pending_replies;
   GList *used_images;
+  struct tgp_prio_queue *media_queue;
+  GList *xfers;
+  GList *xfer_queue;
+  int media_loading;
   guint write_timer;
   guint login_timer;
   guint out_timer;
+  guint reply_timer;
+  guint reads_timer;
+  guint photo_timer;
+  guint status_timer;
+  guint hits_timer;
+  guint xfer_timer;
   struct request_values_data *request_code_data;
   int password_retries;
   int login_retries;
   PurpleRoomlist *roomlist;
   GHashTable *pending_chat_info;
   GHashTable *pending_channels;
+  struct tgp_prio_queue *channel_queue;
+  int channels_loading;
+  GHashTable *channel_queues;
   GHashTable *id_to_purple_name;
   GHashTable *purple_name_to_id;
+  GHashTable *purple_names;
+  gsize purple_names_size;
+  GHashTable *print_name_suffixes;
   GHashTable *channel_members;
+  GHashTable *buddy_nodes;
+  GHashTable *chat_nodes;
+  int blist_indexed;
+  GQueue *pending_photos;
+  GHashTable *user_states;
+  long inactive_cutoff;
   GList *pending_joins;
   int dialogues_ready;
+  int history_days;
+  struct tgp_trace_stats *trace;
+  struct tgp_net_bucket buckets[tgp_net_directions];
   gchar *download_dir;
   gchar *download_uri;
 } connection_data;
 
+struct tgp_xfer_copy {
+  int in;
+  int out;
+  off_t offset;
+  off_t size;
+  int no_copy_range;
+  int no_sendfile;
+  guint timer;
+  char *from;
+  char *to;
+};
+
 struct tgp_xfer_send_data {
-  int timer;
+  size_t bytes;
+  int estimated;
+  gint64 started;
   int loading;
+  tgl_peer_id_t peer;
+  void (*load) (struct tgp_xfer_send_data *data);
+  struct tgp_xfer_copy *copy;
+  char *record;
   PurpleXfer *xfer;
   connection_data *conn;
   struct tgl_message *msg;
@@ -68,6 +167,45 @@ struct tgp_msg_loading {
   void *data;
   int error;
   char *error_msg;
+  int media_deferred;
+  int media_only;
+  char *cache_key;
+  struct tgp_trace trace;
+  GList *link;
+  GSequenceIter *channel_iter;
+};
+
+struct tgp_media_load {
+  struct tgl_message *msg;
+  struct tgp_msg_loading *C;
+  tgl_peer_id_t peer;
+  char *cache_key;
+  char *cached;
+  int pinned;
+};
+
+enum tgp_msg_cache_state {
+  tgp_msg_cache_loading,
+  tgp_msg_cache_available
+};
+
+struct tgp_msg_cache_entry {
+  tgl_message_id_t id;
+  enum tgp_msg_cache_state state;
+  GList *waiting;
+  GList *lru_link;
+};
+
+struct tgp_sticker_entry {
+  long long id;
+  int img;
+  GList *lru_link;
+};
+
+struct tgp_pending_read {
+  gint64 key;
+  tgl_peer_id_t id;
+  long long max_id;
 };
 
 struct tgp_msg_sending {
@@ -77,6 +215,7 @@ struct tgp_msg_sending {
 };
 
 void pending_reads_send_all (struct tgl_state *TLS);
+void pending_reads_schedule (struct tgl_state *TLS);
 void pending_reads_add (struct tgl_state *TLS, struct tgl_message *M);
 void pending_reads_send_user (struct tgl_state *TLS, tgl_peer_id_t id);
 
@@ -86,6 +225,9 @@ connection_data *connection_data_init (struct tgl_state *TLS, PurpleConnection *
 struct tgp_msg_loading *tgp_msg_loading_init (struct tgl_message *M);
 struct tgp_msg_sending *tgp_msg_sending_init (struct tgl_state *TLS, char *M, tgl_peer_id_t to);
 void tgp_msg_loading_free (gpointer data);
+void tgp_media_load_free (gpointer data);
+void tgp_msg_cache_entry_free (gpointer data);
+void tgp_sticker_entry_free (gpointer data);
 void tgp_msg_sending_free (gpointer data);
 #endif
 
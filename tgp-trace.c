@@ -0,0 +1,172 @@
+/*
+ This file is part of telegram-purple
+ 
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ 
+ Copyright Matthias Jentsch 2016
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tgp-trace.h"
+
+/*
+ Every received message is stamped when the data it was parsed from was read from the socket, when it was handed to
+ tgp_msg_recv, when each dependency it was waiting for completed and when it was finally displayed. The stages
+ are aggregated into histograms with logarithmic millisecond buckets and the slowest messages are kept to show
+ what they were waiting for.
+*/
+
+static const char *tgp_trace_stage_names[tgp_trace_stages] = {
+  "receive",
+  "media",
+  "chat info",
+  "channel history",
+  "reply",
+  "queue",
+  "total"
+};
+
+void tgp_trace_read (struct tgl_state *TLS) {
+  tls_get_data (TLS)->trace->last_read = g_get_monotonic_time ();
+}
+
+void tgp_trace_recv (struct tgl_state *TLS, struct tgp_msg_loading *C) {
+  C->trace.read = tls_get_data (TLS)->trace->last_read;
+  C->trace.recv = g_get_monotonic_time ();
+}
+
+void tgp_trace_done (struct tgp_msg_loading *C, enum tgp_trace_stage stage) {
+  C->trace.done[stage] = g_get_monotonic_time ();
+}
+
+static int tgp_trace_bucket (gint64 duration) {
+  gint64 ms = duration / 1000;
+  if (ms <= 0) {
+    return 0;
+  }
+  return MIN(g_bit_storage (ms), TGP_TRACE_BUCKETS - 1);
+}
+
+static void tgp_trace_sample_add (struct tgp_trace_stats *S, struct tgp_trace_sample *T) {
+  int i, min = 0;
+  if (S->samples < TGP_TRACE_SLOWEST) {
+    S->slowest[S->samples ++] = *T;
+    return;
+  }
+  for (i = 1; i < S->samples; i ++) {
+    if (S->slowest[i].duration[tgp_trace_total] < S->slowest[min].duration[tgp_trace_total]) {
+      min = i;
+    }
+  }
+  if (S->slowest[min].duration[tgp_trace_total] < T->duration[tgp_trace_total]) {
+    S->slowest[min] = *T;
+  }
+}
+
+void tgp_trace_display (struct tgl_state *TLS, struct tgp_msg_loading *C) {
+  struct tgp_trace_stats *S = tls_get_data (TLS)->trace;
+  struct tgp_trace *T = &C->trace;
+  gint64 now = g_get_monotonic_time ();
+
+  // messages replayed from the binlog were never read from the network
+  gint64 start = (T->read && T->read <= T->recv) ? T->read : T->recv;
+  gint64 ready = T->recv;
+
+  struct tgp_trace_sample sample;
+  sample.server_id = C->msg->server_id;
+  sample.to_id = C->msg->to_id;
+
+  int stage;
+  for (stage = 0; stage < tgp_trace_stages; stage ++) {
+    sample.duration[stage] = -1;
+  }
+  if (start != T->recv) {
+    sample.duration[tgp_trace_receive] = T->recv - start;
+  }
+  for (stage = tgp_trace_media; stage <= tgp_trace_reply; stage ++) {
+    if (T->done[stage]) {
+      sample.duration[stage] = T->done[stage] - T->recv;
+      ready = MAX(ready, T->done[stage]);
+    }
+  }
+  sample.duration[tgp_trace_queue] = now - ready;
+  sample.duration[tgp_trace_total] = now - start;
+
+  for (stage = 0; stage < tgp_trace_stages; stage ++) {
+    if (sample.duration[stage] >= 0) {
+      S->histogram[stage][tgp_trace_bucket (sample.duration[stage])] ++;
+    }
+  }
+  S->count ++;
+  tgp_trace_sample_add (S, &sample);
+}
+
+static int tgp_trace_sample_cmp (const void *a, const void *b) {
+  gint64 x = ((const struct tgp_trace_sample *) a)->duration[tgp_trace_total];
+  gint64 y = ((const struct tgp_trace_sample *) b)->duration[tgp_trace_total];
+  return (x < y) - (x > y);
+}
+
+void tgp_trace_show (struct tgl_state *TLS) {
+  struct tgp_trace_stats *S = tls_get_data (TLS)->trace;
+  GString *str = g_string_new ("");
+  int stage, bucket, i;
+
+  g_string_append_printf (str, _("%d messages displayed since login"), S->count);
+  g_string_append (str, "<br><br>");
+
+  for (stage = 0; stage < tgp_trace_stages; stage ++) {
+    g_string_append_printf (str, "<b>%s</b><br>", tgp_trace_stage_names[stage]);
+    for (bucket = 0; bucket < TGP_TRACE_BUCKETS; bucket ++) {
+      int n = S->histogram[stage][bucket];
+      if (! n) {
+        continue;
+      }
+      if (bucket == TGP_TRACE_BUCKETS - 1) {
+        g_string_append_printf (str, "&gt;= %d ms: %d<br>", 1 << (bucket - 1), n);
+      } else {
+        g_string_append_printf (str, "&lt; %d ms: %d<br>", 1 << bucket, n);
+      }
+    }
+  }
+
+  struct tgp_trace_sample slowest[TGP_TRACE_SLOWEST];
+  memcpy (slowest, S->slowest, sizeof (struct tgp_trace_sample) * S->samples);
+  qsort (slowest, S->samples, sizeof (struct tgp_trace_sample), tgp_trace_sample_cmp);
+
+  g_string_append_printf (str, "<br><b>%s</b><br>", _("Slowest messages"));
+  for (i = 0; i < S->samples; i ++) {
+    struct tgp_trace_sample *T = &slowest[i];
+    tgl_peer_t *P = tgl_peer_get (TLS, T->to_id);
+
+    g_string_append_printf (str, "%s server_id=%lld: %" G_GINT64_FORMAT " ms",
+        P ? P->print_name : "?", T->server_id, T->duration[tgp_trace_total] / 1000);
+    for (stage = 0; stage < tgp_trace_total; stage ++) {
+      if (T->duration[stage] >= 0) {
+        g_string_append_printf (str, ", %s %" G_GINT64_FORMAT " ms", tgp_trace_stage_names[stage],
+            T->duration[stage] / 1000);
+      }
+    }
+    g_string_append (str, "<br>");
+    info ("slowest message %s server_id=%lld total=%" G_GINT64_FORMAT "us", P ? P->print_name : "?",
+        T->server_id, T->duration[tgp_trace_total]);
+  }
+
+  purple_notify_formatted (tls_get_conn (TLS), _("Message Latency"), _("Message Latency"), NULL, str->str,
+      NULL, NULL);
+  g_string_free (str, TRUE);
+}
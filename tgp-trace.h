@@ -0,0 +1,51 @@
+/*
+ This file is part of telegram-purple
+ 
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ 
+ Copyright Matthias Jentsch 2016
+ */
+
+#ifndef tgp_trace_h
+#define tgp_trace_h
+
+#include "telegram-purple.h"
+
+/**
+ * Remember the time at which data was last read from the network
+ */
+void tgp_trace_read (struct tgl_state *TLS);
+
+/**
+ * Start tracing a message that was handed to tgp_msg_recv
+ */
+void tgp_trace_recv (struct tgl_state *TLS, struct tgp_msg_loading *C);
+
+/**
+ * Note that a message finished waiting for the dependency of the given stage
+ */
+void tgp_trace_done (struct tgp_msg_loading *C, enum tgp_trace_stage stage);
+
+/**
+ * Finish tracing a message that was handed to the conversation and add it to the statistics
+ */
+void tgp_trace_display (struct tgl_state *TLS, struct tgp_msg_loading *C);
+
+/**
+ * Display the latency histograms and the slowest messages since login
+ */
+void tgp_trace_show (struct tgl_state *TLS);
+
+#endif
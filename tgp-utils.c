@@ -140,3 +140,102 @@ void tgp_replace (char *string, char what, char with) {
     }
   }
 }
+
+/*
+ Queued work that belongs to a peer is kept in two sequences ordered by rank, one for peers with an open
+ conversation and one for all others, so that the next item is found in logarithmic time. Whether a conversation
+ is open is looked up once when the item is queued and updated with tgp_prio_queue_set_open() when conversations
+ are opened or closed.
+*/
+struct tgp_prio_item {
+  tgl_peer_id_t peer;
+  gint64 rank;
+  gpointer data;
+};
+
+static gint tgp_prio_item_cmp (gconstpointer a, gconstpointer b, gpointer ignored) {
+  const struct tgp_prio_item *A = a, *B = b;
+
+  // highest rank first
+  return A->rank > B->rank ? -1 : A->rank < B->rank;
+}
+
+struct tgp_prio_queue *tgp_prio_queue_new (void) {
+  struct tgp_prio_queue *Q = g_new0 (struct tgp_prio_queue, 1);
+  Q->open = g_sequence_new (g_free);
+  Q->closed = g_sequence_new (g_free);
+  return Q;
+}
+
+static void tgp_prio_queue_clear (GSequence *S, GDestroyNotify free_func) {
+  GSequenceIter *it;
+  for (it = g_sequence_get_begin_iter (S); ! g_sequence_iter_is_end (it); it = g_sequence_iter_next (it)) {
+    free_func (((struct tgp_prio_item *) g_sequence_get (it))->data);
+  }
+  g_sequence_free (S);
+}
+
+void tgp_prio_queue_free (struct tgp_prio_queue *Q, GDestroyNotify free_func) {
+  tgp_prio_queue_clear (Q->open, free_func);
+  tgp_prio_queue_clear (Q->closed, free_func);
+  g_free (Q);
+}
+
+void tgp_prio_queue_push (struct tgp_prio_queue *Q, tgl_peer_id_t peer, int open, gint64 rank, gpointer data) {
+  struct tgp_prio_item *I = g_new0 (struct tgp_prio_item, 1);
+  I->peer = peer;
+  I->rank = rank;
+  I->data = data;
+  g_sequence_insert_sorted (open ? Q->open : Q->closed, I, tgp_prio_item_cmp, NULL);
+}
+
+gpointer tgp_prio_queue_pop (struct tgp_prio_queue *Q) {
+  GSequence *S = g_sequence_get_length (Q->open) ? Q->open : Q->closed;
+  GSequenceIter *it = g_sequence_get_begin_iter (S);
+  if (g_sequence_iter_is_end (it)) {
+    return NULL;
+  }
+  gpointer data = ((struct tgp_prio_item *) g_sequence_get (it))->data;
+  g_sequence_remove (it);
+  return data;
+}
+
+int tgp_prio_queue_length (struct tgp_prio_queue *Q) {
+  return g_sequence_get_length (Q->open) + g_sequence_get_length (Q->closed);
+}
+
+static int tgp_prio_item_of (struct tgp_prio_item *I, tgl_peer_id_t peer) {
+  return tgl_get_peer_type (I->peer) == tgl_get_peer_type (peer) && tgl_get_peer_id (I->peer) == tgl_get_peer_id (peer);
+}
+
+void tgp_prio_queue_set_open (struct tgp_prio_queue *Q, tgl_peer_id_t peer, int open) {
+  GSequence *from = open ? Q->closed : Q->open, *to = open ? Q->open : Q->closed;
+  GSequenceIter *it = g_sequence_get_begin_iter (from);
+  while (! g_sequence_iter_is_end (it)) {
+    GSequenceIter *next = g_sequence_iter_next (it);
+    struct tgp_prio_item *I = g_sequence_get (it);
+    if (tgp_prio_item_of (I, peer)) {
+      g_sequence_move (it, g_sequence_get_begin_iter (to));
+      g_sequence_sort_changed (it, tgp_prio_item_cmp, NULL);
+    }
+    it = next;
+  }
+}
+
+static void tgp_prio_queue_remove_from (GSequence *S, tgl_peer_id_t peer, GDestroyNotify free_func) {
+  GSequenceIter *it = g_sequence_get_begin_iter (S);
+  while (! g_sequence_iter_is_end (it)) {
+    GSequenceIter *next = g_sequence_iter_next (it);
+    struct tgp_prio_item *I = g_sequence_get (it);
+    if (tgp_prio_item_of (I, peer)) {
+      free_func (I->data);
+      g_sequence_remove (it);
+    }
+    it = next;
+  }
+}
+
+void tgp_prio_queue_remove (struct tgp_prio_queue *Q, tgl_peer_id_t peer, GDestroyNotify free_func) {
+  tgp_prio_queue_remove_from (Q->open, peer, free_func);
+  tgp_prio_queue_remove_from (Q->closed, peer, free_func);
+}
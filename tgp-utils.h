@@ -50,4 +50,29 @@ const char *tgp_mime_to_filetype (const char *mime);
 int tgp_startswith (const char *str, const char *with);
 void tgp_replace (char *string, char what, char with);
 
+struct tgp_prio_queue {
+  GSequence *open;
+  GSequence *closed;
+};
+
+/**
+ * Create a queue that returns the items of peers with an open conversation first, and the highest rank first
+ * among them
+ */
+struct tgp_prio_queue *tgp_prio_queue_new (void);
+void tgp_prio_queue_free (struct tgp_prio_queue *Q, GDestroyNotify free_func);
+void tgp_prio_queue_push (struct tgp_prio_queue *Q, tgl_peer_id_t peer, int open, gint64 rank, gpointer data);
+gpointer tgp_prio_queue_pop (struct tgp_prio_queue *Q);
+int tgp_prio_queue_length (struct tgp_prio_queue *Q);
+
+/**
+ * Move all queued items of a peer whose conversation was opened or closed
+ */
+void tgp_prio_queue_set_open (struct tgp_prio_queue *Q, tgl_peer_id_t peer, int open);
+
+/**
+ * Drop all queued items of a peer
+ */
+void tgp_prio_queue_remove (struct tgp_prio_queue *Q, tgl_peer_id_t peer, GDestroyNotify free_func);
+
 #endif